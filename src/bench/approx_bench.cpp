@@ -0,0 +1,193 @@
+// 近似 kNN 评测：对一组近似参数报告相对精确搜索的 recall@k、多数表决预测一致率和吞吐量，
+// 用来挑选精度/延迟的工作点。
+//
+// 用法（在 src 目录下编译运行）：
+//   g++ -std=c++17 -O2 -pthread bench/approx_bench.cpp -o approx_bench
+//   ./approx_bench [训练CSV] [测试CSV] [k]
+//   ./approx_bench --synthetic 训练点数 维度 查询数 [k]
+#include "../data/loader.h"
+#include "../data/process.h"
+#include "../model/kdforest.h"
+#include <string.h>
+#include <chrono>
+#include <random>
+
+namespace {
+
+const double MIN_TIMING_SECONDS = 0.2;
+
+struct OperatingPoint {
+    const char* name;
+    int n_trees;                // 0 表示单棵 KD 树
+    ApproxParams params;
+};
+
+ApproxParams make_params(double epsilon, size_t max_leaves, size_t max_evaluations) {
+    ApproxParams params;
+    params.epsilon = epsilon;
+    params.max_leaves = max_leaves;
+    params.max_evaluations = max_evaluations;
+    return params;
+}
+
+// 高斯簇，标签为簇编号的奇偶
+Dataset* make_synthetic(int n_samples, int n_features, int n_clusters, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::uniform_real_distribution<double> center(-4.0, 4.0);
+    std::vector<double> centers((size_t)n_clusters * n_features);
+    for (double& c : centers) c = center(rng);
+
+    Dataset* dataset = new Dataset();
+    DatasetStorage::allocate(dataset, n_samples, n_features);
+    for (int i = 0; i < n_samples; i++) {
+        int cluster = (int)(rng() % n_clusters);
+        double* row = dataset->matrix + (size_t)i * n_features;
+        for (int d = 0; d < n_features; d++) {
+            row[d] = centers[(size_t)cluster * n_features + d] + noise(rng);
+        }
+        dataset->data[i].survived = cluster % 2;
+    }
+    return dataset;
+}
+
+int majority(const Dataset* train, const size_t* neighbors, int count) {
+    int votes = 0;
+    for (int i = 0; i < count; i++) votes += train->data[neighbors[i]].survived;
+    return 2 * votes >= count;
+}
+
+// 反复跑完整批查询直到累计时间足够长，返回每秒查询数
+template <class Search>
+double measure_qps(size_t n_queries, const Search& search) {
+    size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        for (size_t i = 0; i < n_queries; i++) search(i);
+        total += n_queries;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_TIMING_SECONDS);
+    return total / elapsed;
+}
+
+}
+
+int main(int argc, char** argv) {
+    const char* train_path = "../data/train.csv";
+    const char* test_path = "../data/test.csv";
+    int k = 5;
+    Dataset* train = nullptr;
+    Dataset* test = nullptr;
+    const double* weights = nullptr;
+    double custom_weights[] = {2.0, 3.0, 1.5, 1.0, 1.0, 1.2, 0.5};
+
+    if (argc > 1 && strcmp(argv[1], "--synthetic") == 0) {
+        if (argc < 5) {
+            printf("用法: %s --synthetic 训练点数 维度 查询数 [k]\n", argv[0]);
+            return 1;
+        }
+        int n = atoi(argv[2]), d = atoi(argv[3]), q = atoi(argv[4]);
+        if (argc > 5) k = atoi(argv[5]);
+        if (n <= 0 || d <= 0 || q <= 0) {
+            printf("参数无效\n");
+            return 1;
+        }
+        train = make_synthetic(n, d, 32, 1);
+        test = make_synthetic(q, d, 32, 2);
+        printf("合成数据: %d 个训练点, %d 维, %d 个查询, k=%d\n", n, d, q, k);
+    } else {
+        if (argc > 1) train_path = argv[1];
+        if (argc > 2) test_path = argv[2];
+        if (argc > 3) k = atoi(argv[3]);
+        train = DataLoader::load_csv_mapped(train_path, true);
+        test = DataLoader::load_csv_mapped(test_path, false);
+        if (!train || !test) {
+            printf("数据加载失败\n");
+            return 1;
+        }
+        PreprocessStats stats = {};
+        DataProcessor::fit_transform(train, &stats);
+        DataProcessor::apply_stats(test, stats);
+        weights = custom_weights;
+        printf("数据: %s (%d 个训练点), %s (%d 个查询), k=%d\n",
+               train_path, train->n_samples, test_path, test->n_samples, k);
+    }
+    if (k <= 0) {
+        printf("k 必须为正数\n");
+        return 1;
+    }
+
+    size_t n_queries = test->n_samples;
+    KDTree tree(train);
+    NeighborSet scratch;
+
+    // 精确搜索的结果作为基准
+    NeighborMatrix exact;
+    exact.resize(n_queries, k);
+    double exact_qps = measure_qps(n_queries, [&](size_t i) {
+        exact.set_count(i, tree.find_k_nearest(DatasetStorage::row(test, i), k, weights, scratch,
+                                               exact.indices(i), exact.distances(i)));
+    });
+
+    std::vector<OperatingPoint> points = {
+        {"eps=0.5", 0, make_params(0.5, 0, 0)},
+        {"eps=1", 0, make_params(1.0, 0, 0)},
+        {"eps=2", 0, make_params(2.0, 0, 0)},
+        {"leaves=1", 0, make_params(0.0, 1, 0)},
+        {"leaves=2", 0, make_params(0.0, 2, 0)},
+        {"leaves=4", 0, make_params(0.0, 4, 0)},
+        {"leaves=8", 0, make_params(0.0, 8, 0)},
+        {"evals=256", 0, make_params(0.0, 0, 256)},
+        {"eps=1,leaves=4", 0, make_params(1.0, 4, 0)},
+        {"forest2,leaves=4", 2, make_params(0.0, 4, 0)},
+        {"forest4,leaves=4", 4, make_params(0.0, 4, 0)},
+        {"forest4,leaves=8", 4, make_params(0.0, 8, 0)},
+        {"forest8,leaves=16", 8, make_params(0.0, 16, 0)},
+    };
+
+    printf("\n%-20s %10s %10s %12s %8s\n", "工作点", "recall@k", "预测一致", "查询/秒", "加速");
+    printf("%-20s %10.4f %10.4f %12.0f %8.2f\n", "exact", 1.0, 1.0, exact_qps, 1.0);
+
+    NeighborMatrix approx;
+    approx.resize(n_queries, k);
+    RandomizedKDForest::Scratch forest_scratch;
+    for (const OperatingPoint& point : points) {
+        RandomizedKDForest* forest = point.n_trees > 0 ?
+            new RandomizedKDForest(train, point.n_trees) : nullptr;
+        auto search = [&](size_t i) {
+            const double* query = DatasetStorage::row(test, i);
+            approx.set_count(i, forest ?
+                forest->find_k_nearest(query, k, weights, point.params, forest_scratch,
+                                       approx.indices(i), approx.distances(i)) :
+                tree.find_k_nearest_approx(query, k, weights, point.params, scratch,
+                                           approx.indices(i), approx.distances(i)));
+        };
+        double qps = measure_qps(n_queries, search);
+
+        size_t hits = 0, expected = 0, agree = 0;
+        for (size_t i = 0; i < n_queries; i++) {
+            const size_t* truth = exact.indices(i);
+            const size_t* found = approx.indices(i);
+            for (int a = 0; a < exact.count(i); a++) {
+                for (int b = 0; b < approx.count(i); b++) {
+                    if (found[b] == truth[a]) {
+                        hits++;
+                        break;
+                    }
+                }
+            }
+            expected += exact.count(i);
+            agree += majority(train, truth, exact.count(i)) ==
+                     majority(train, found, approx.count(i));
+        }
+        printf("%-20s %10.4f %10.4f %12.0f %8.2f\n", point.name,
+               expected ? (double)hits / expected : 1.0, (double)agree / n_queries,
+               qps, qps / exact_qps);
+        delete forest;
+    }
+
+    DataLoader::free_dataset(train);
+    DataLoader::free_dataset(test);
+    return 0;
+}
@@ -0,0 +1,436 @@
+// 端到端微基准：在 Titanic 格式的合成数据上分别计时 CSV 加载、预处理、建树、
+// 单条查询、批量查询和完整预测，结果可写成 JSON，并与保存的基线比较以发现性能回退。
+//
+// 用法（在 src 目录下编译运行）：
+//   g++ -std=c++17 -O2 -pthread bench/benchmark.cpp -o benchmark
+//   ./benchmark [选项]
+//     --rows 10000,100000     训练集行数列表（10K ~ 10M）
+//     --queries N             查询行数（默认 10000）
+//     --k K                   近邻数（默认 5）
+//     --threads T             加载、建树和预测用的线程数（默认全部硬件线程）
+//     --repeat R              每项重复次数，报告中位数（默认 5）
+//     --clusters C            合成数据的簇数（默认 16）
+//     --spread S              簇内离散程度，0 为全部重合、1 为接近均匀（默认 0.3）
+//     --duplicates F          与前一行特征完全相同的行所占比例（默认 0.05）
+//     --seed N                随机种子（默认 1）
+//     --workdir DIR           合成 CSV 存放目录（默认 /tmp）
+//     --json FILE             结果写入 JSON
+//     --baseline FILE         与基线 JSON 比较，中位数变慢超过容差时返回 2
+//     --tolerance X           回退判定容差（默认 0.10，即慢 10%）
+//   ./benchmark --generate 文件 行数 [--test] [--clusters C] [--spread S] [--duplicates F] [--seed N]
+//     只生成合成 CSV；--test 时不写 Survived 列
+#include "../data/loader.h"
+#include "../data/process.h"
+#include "../model/predictor.h"
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct GeneratorOptions {
+    int clusters = 16;
+    double spread = 0.3;
+    double duplicates = 0.05;
+    uint64_t seed = 1;
+};
+
+// 一个簇的原型乘客
+struct Prototype {
+    int pclass;
+    int sex;            // 0 男 1 女
+    double age;
+    int sibsp;
+    int parch;
+    double fare;
+    int embarked;       // 0 S, 1 C, 2 Q
+};
+
+const char* const EMBARKED_CODES[] = {"S", "C", "Q"};
+const char* const SURNAMES[] = {"Smith", "Brown", "Kelly", "Johnson", "Andersson", "Sage",
+                                "Goodwin", "Carter", "Fortune", "Panula", "Rice", "Skoog"};
+
+// 按 Titanic 的列和取值范围生成 CSV：先随机出若干簇原型，每行选一个簇后按 spread 加扰动；
+// 约 20% 的年龄留空，姓名带引号和逗号，覆盖解析器的各条路径
+bool generate_csv(const char* path, long long rows, bool with_label,
+                  const GeneratorOptions& options, long long first_id = 1) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("无法创建文件: %s\n", path);
+        return false;
+    }
+    std::mt19937_64 rng(options.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    int n_clusters = std::max(1, options.clusters);
+    std::vector<Prototype> prototypes(n_clusters);
+    for (Prototype& p : prototypes) {
+        p.pclass = 1 + (int)(rng() % 3);
+        p.sex = (int)(rng() % 2);
+        p.age = 1.0 + uniform(rng) * 70.0;
+        p.sibsp = (int)(rng() % 4);
+        p.parch = (int)(rng() % 3);
+        p.fare = p.pclass == 1 ? 30.0 + uniform(rng) * 200.0 : 5.0 + uniform(rng) * 40.0;
+        p.embarked = (int)(rng() % 3);
+    }
+
+    double spread = std::min(std::max(options.spread, 0.0), 1.0);
+    fputs(with_label ?
+          "PassengerId,Survived,Pclass,Name,Sex,Age,SibSp,Parch,Ticket,Fare,Cabin,Embarked\n" :
+          "PassengerId,Pclass,Name,Sex,Age,SibSp,Parch,Ticket,Fare,Cabin,Embarked\n", file);
+
+    Prototype row = prototypes[0];
+    bool age_missing = false;
+    for (long long i = 0; i < rows; i++) {
+        // 重复行沿用上一行的全部特征，只换编号
+        if (i == 0 || uniform(rng) >= options.duplicates) {
+            const Prototype& p = prototypes[rng() % n_clusters];
+            row = p;
+            if (uniform(rng) < spread) row.pclass = 1 + (int)(rng() % 3);
+            if (uniform(rng) < spread) row.sex = (int)(rng() % 2);
+            if (uniform(rng) < spread) row.embarked = (int)(rng() % 3);
+            if (uniform(rng) < spread) row.sibsp = (int)(rng() % 6);
+            if (uniform(rng) < spread) row.parch = (int)(rng() % 5);
+            row.age = std::min(80.0, std::max(0.42, p.age + normal(rng) * spread * 30.0));
+            row.fare = std::max(0.0, p.fare * (1.0 + normal(rng) * spread));
+            age_missing = uniform(rng) < 0.2;
+        }
+
+        fprintf(file, "%lld,", first_id + i);
+        if (with_label) {
+            // 女性、高等舱、儿童的生还率高，另加噪声
+            double score = (row.sex ? 1.5 : -1.0) + (2 - row.pclass) * 0.8 +
+                           (row.age < 12 ? 0.8 : 0.0) + normal(rng) * 0.8;
+            fprintf(file, "%d,", score > 0 ? 1 : 0);
+        }
+        fprintf(file, "%d,\"%s, %s. Passenger%lld\",%s,", row.pclass,
+                SURNAMES[(size_t)(first_id + i) % (sizeof(SURNAMES) / sizeof(SURNAMES[0]))],
+                row.sex ? "Mrs" : "Mr", first_id + i, row.sex ? "female" : "male");
+        if (!age_missing) fprintf(file, "%.1f", row.age);
+        fprintf(file, ",%d,%d,%lld,%.4f,,%s\n", row.sibsp, row.parch, 100000 + i, row.fare,
+                EMBARKED_CODES[row.embarked]);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    if (!ok) printf("写入失败: %s\n", path);
+    return ok;
+}
+
+// 一项测量结果；items 为每次运行处理的条目数（行或查询），用于换算吞吐量
+struct Result {
+    std::string name;
+    long long rows;
+    double median_ms;
+    double min_ms;
+    double max_ms;
+    long long items;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+Result summarize(const char* name, long long rows, long long items, std::vector<double> times) {
+    std::sort(times.begin(), times.end());
+    Result result;
+    result.name = name;
+    result.rows = rows;
+    result.median_ms = times[times.size() / 2];
+    result.min_ms = times.front();
+    result.max_ms = times.back();
+    result.items = items;
+    return result;
+}
+
+// 每次运行前调用 setup（不计时），再计时 body
+template <class Setup, class Body>
+Result measure(const char* name, long long rows, long long items, int repeat,
+               const Setup& setup, const Body& body) {
+    std::vector<double> times;
+    for (int r = 0; r < repeat; r++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        times.push_back(elapsed_ms(start));
+    }
+    return summarize(name, rows, items, times);
+}
+
+void print_result(const Result& r) {
+    double per_second = r.median_ms > 0 ? r.items * 1000.0 / r.median_ms : 0.0;
+    printf("%-14s %10lld %12.3f %12.3f %12.3f %14.0f\n", r.name.c_str(), r.rows,
+           r.median_ms, r.min_ms, r.max_ms, per_second);
+}
+
+bool write_json(const char* path, const std::vector<Result>& results, int threads, int k) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("无法创建文件: %s\n", path);
+        return false;
+    }
+    // 每项结果占一行，基线读取时逐行解析
+    fprintf(file, "{\n  \"threads\": %d,\n  \"k\": %d,\n  \"results\": [\n", threads, k);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"rows\": %lld, \"median_ms\": %.6f, "
+                      "\"min_ms\": %.6f, \"max_ms\": %.6f, \"items\": %lld}%s\n",
+                r.name.c_str(), r.rows, r.median_ms, r.min_ms, r.max_ms, r.items,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+bool json_field(const char* line, const char* key, std::string& value) {
+    std::string pattern = std::string("\"") + key + "\":";
+    const char* p = strstr(line, pattern.c_str());
+    if (!p) return false;
+    p += pattern.size();
+    while (*p == ' ') p++;
+    const char* end = p;
+    if (*p == '"') {
+        end = strchr(++p, '"');
+        if (!end) return false;
+    } else {
+        while (*end && *end != ',' && *end != '}') end++;
+    }
+    value.assign(p, end);
+    return true;
+}
+
+// 读取 write_json 写出的文件
+bool read_baseline(const char* path, std::vector<Result>& results) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("无法打开基线文件: %s\n", path);
+        return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        std::string name, rows, median;
+        if (!json_field(line, "name", name) || !json_field(line, "rows", rows) ||
+            !json_field(line, "median_ms", median)) {
+            continue;
+        }
+        Result r = Result();
+        r.name = name;
+        r.rows = atoll(rows.c_str());
+        r.median_ms = atof(median.c_str());
+        results.push_back(r);
+    }
+    fclose(file);
+    return true;
+}
+
+// 返回变慢超过容差的项数
+int compare_with_baseline(const std::vector<Result>& results, const std::vector<Result>& baseline,
+                          double tolerance) {
+    printf("\n%-14s %10s %12s %12s %9s\n", "项目", "行数", "基线ms", "当前ms", "变化");
+    int regressions = 0;
+    for (const Result& r : results) {
+        for (const Result& b : baseline) {
+            if (b.name != r.name || b.rows != r.rows || b.median_ms <= 0) continue;
+            double change = r.median_ms / b.median_ms - 1.0;
+            bool regressed = change > tolerance;
+            regressions += regressed;
+            printf("%-14s %10lld %12.3f %12.3f %+8.1f%%%s\n", r.name.c_str(), r.rows,
+                   b.median_ms, r.median_ms, change * 100.0, regressed ? "  回退" : "");
+            break;
+        }
+    }
+    return regressions;
+}
+
+std::vector<long long> parse_list(const char* text) {
+    std::vector<long long> values;
+    for (const char* p = text; *p;) {
+        char* end;
+        long long v = strtoll(p, &end, 10);
+        if (end == p) break;
+        if (v > 0) values.push_back(v);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+// 对一个训练集规模跑完整组基准
+void run_size(long long rows, long long n_queries, int k, int threads, int repeat,
+              const GeneratorOptions& options, const std::string& workdir,
+              std::vector<Result>& results) {
+    std::string train_path = workdir + "/knn_bench_train_" + std::to_string(rows) + ".csv";
+    std::string test_path = workdir + "/knn_bench_test_" + std::to_string(n_queries) + ".csv";
+    GeneratorOptions test_options = options;
+    test_options.seed = options.seed + 1;
+    if (!generate_csv(train_path.c_str(), rows, true, options) ||
+        !generate_csv(test_path.c_str(), n_queries, false, test_options, rows + 1)) {
+        return;
+    }
+
+    Dataset* train = nullptr;
+    results.push_back(measure("csv_load", rows, rows, repeat,
+        [&] { DataLoader::free_dataset(train); train = nullptr; },
+        [&] { train = DataLoader::load_csv_mapped(train_path.c_str(), true, threads); }));
+    print_result(results.back());
+
+    // 预处理原地修改数据，每次重新加载
+    PreprocessStats stats = {};
+    results.push_back(measure("preprocess", rows, rows, repeat,
+        [&] {
+            DataLoader::free_dataset(train);
+            train = DataLoader::load_csv_mapped(train_path.c_str(), true, threads);
+        },
+        [&] { DataProcessor::fit_transform(train, &stats, threads); }));
+    print_result(results.back());
+
+    Dataset* test = DataLoader::load_csv_mapped(test_path.c_str(), false, threads);
+    if (!train || !test) {
+        printf("数据加载失败\n");
+        DataLoader::free_dataset(train);
+        DataLoader::free_dataset(test);
+        return;
+    }
+    DataProcessor::apply_stats(test, stats);
+
+    KDTree* tree = nullptr;
+    results.push_back(measure("tree_build", rows, rows, repeat,
+        [&] { delete tree; tree = nullptr; },
+        [&] { tree = new KDTree(train, KDTree::DEFAULT_LEAF_SIZE, 0, threads); }));
+    print_result(results.back());
+
+    double custom_weights[] = {2.0, 3.0, 1.5, 1.0, 1.0, 1.2, 0.5};
+    NeighborMatrix neighbors;
+    neighbors.resize(test->n_samples, k);
+    NeighborSet scratch;
+    results.push_back(measure("query_single", rows, test->n_samples, repeat, [] {},
+        [&] {
+            for (int i = 0; i < test->n_samples; i++) {
+                neighbors.set_count(i, tree->find_k_nearest(
+                    DatasetStorage::row(test, i), k, custom_weights, scratch,
+                    neighbors.indices(i), neighbors.distances(i)));
+            }
+        }));
+    print_result(results.back());
+
+    const SpatialIndex* index = tree;
+    results.push_back(measure("query_batch", rows, test->n_samples, repeat, [] {},
+        [&] {
+            index->find_k_nearest_batch(test->matrix, test->n_samples, k, custom_weights,
+                                        neighbors, 0);
+        }));
+    print_result(results.back());
+    delete tree;
+
+    // 与 main 相同的配置：KD 树引擎、多线程
+    Predictor predictor(train, custom_weights);
+    predictor.set_engine(ENGINE_KDTREE);
+    predictor.set_num_threads(threads);
+    std::vector<int> predictions;
+    results.push_back(measure("predict", rows, test->n_samples, repeat, [] {},
+        [&] { predictor.predict_with_neighbors(test, k, predictions, neighbors); }));
+    print_result(results.back());
+
+    DataLoader::free_dataset(train);
+    DataLoader::free_dataset(test);
+    remove(train_path.c_str());
+    remove(test_path.c_str());
+}
+
+bool read_generator_option(int& i, int argc, char** argv, GeneratorOptions& options) {
+    if (i + 1 >= argc) return false;
+    if (strcmp(argv[i], "--clusters") == 0) options.clusters = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--spread") == 0) options.spread = atof(argv[++i]);
+    else if (strcmp(argv[i], "--duplicates") == 0) options.duplicates = atof(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0) options.seed = strtoull(argv[++i], nullptr, 10);
+    else return false;
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    GeneratorOptions options;
+
+    if (argc > 1 && strcmp(argv[1], "--generate") == 0) {
+        if (argc < 4) {
+            printf("用法: %s --generate 文件 行数 [--test] [--clusters C] [--spread S] "
+                   "[--duplicates F] [--seed N]\n", argv[0]);
+            return 1;
+        }
+        bool with_label = true;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--test") == 0) {
+                with_label = false;
+            } else if (!read_generator_option(i, argc, argv, options)) {
+                printf("未知参数: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        long long rows = atoll(argv[3]);
+        if (rows <= 0) {
+            printf("行数必须为正数\n");
+            return 1;
+        }
+        return generate_csv(argv[2], rows, with_label, options) ? 0 : 1;
+    }
+
+    std::vector<long long> sizes = {10000, 100000};
+    long long n_queries = 10000;
+    int k = 5;
+    int threads = ThreadPool::default_threads();
+    int repeat = 5;
+    double tolerance = 0.10;
+    std::string workdir = "/tmp";
+    const char* json_path = nullptr;
+    const char* baseline_path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (read_generator_option(i, argc, argv, options)) continue;
+        if (has_value && strcmp(argv[i], "--rows") == 0) sizes = parse_list(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--queries") == 0) n_queries = atoll(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--k") == 0) k = atoi(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--threads") == 0) threads = atoi(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--repeat") == 0) repeat = atoi(argv[++i]);
+        else if (has_value && strcmp(argv[i], "--workdir") == 0) workdir = argv[++i];
+        else if (has_value && strcmp(argv[i], "--json") == 0) json_path = argv[++i];
+        else if (has_value && strcmp(argv[i], "--baseline") == 0) baseline_path = argv[++i];
+        else if (has_value && strcmp(argv[i], "--tolerance") == 0) tolerance = atof(argv[++i]);
+        else {
+            printf("未知参数: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (sizes.empty() || n_queries <= 0 || k <= 0 || repeat <= 0) {
+        printf("参数无效\n");
+        return 1;
+    }
+    if (threads <= 0) threads = ThreadPool::default_threads();
+
+    printf("合成数据: %d 簇, 离散度 %.2f, 重复行 %.0f%%; %lld 个查询, k=%d, %d 线程, 重复 %d 次\n\n",
+           options.clusters, options.spread, options.duplicates * 100.0, n_queries, k,
+           threads, repeat);
+    printf("%-14s %10s %12s %12s %12s %14s\n", "项目", "行数", "中位数ms", "最小ms", "最大ms",
+           "条/秒");
+
+    std::vector<Result> results;
+    for (long long rows : sizes) {
+        run_size(rows, n_queries, k, threads, repeat, options, workdir, results);
+    }
+
+    if (json_path && !write_json(json_path, results, threads, k)) return 1;
+    if (baseline_path) {
+        std::vector<Result> baseline;
+        if (!read_baseline(baseline_path, baseline)) return 1;
+        int regressions = compare_with_baseline(results, baseline, tolerance);
+        if (regressions > 0) {
+            printf("\n%d 项比基线慢超过 %.0f%%\n", regressions, tolerance * 100.0);
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+// 动态索引压力评测：在后台合并进行的同时并发执行插入、删除和查询，报告各自的吞吐量，
+// 结束后核对计数和查询结果：size() 须等于未删除的点数，每个查询的 k 近邻须与
+// 对全部未删除点暴力搜索的结果（按 (距离, 编号) 排序）完全相同。核对失败时返回 1。
+// 批量 load 的同时删除刚分配的编号，覆盖 load 建段与删除并发的情形；
+// 初始点数越大，删除落在分配编号与建段之间的机会越多（例如 2000000）。
+// 先用离散坐标跑一遍（大量等距点，检验排序），再用连续坐标跑一遍：连续坐标的距离有舍入，
+// 缓冲中的点与已合并进段的点的距离须逐位相同。后者应在开启 FMA 的编译下运行。
+//
+// 用法（在 src 目录下编译运行）：
+//   g++ -std=c++17 -O2 -mfma -mavx2 -pthread bench/dynamic_bench.cpp -o dynamic_bench
+//   ./dynamic_bench [初始点数] [插入点数] [查询线程数] [k]
+#include "../model/dynamic_index.h"
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int N_FEATURES = FEATURE_COUNT;
+const int REMOVE_EVERY = 3;             // 每插入这么多个点删除一个随机的已有点
+const size_t VERIFY_QUERIES = 500;
+
+// lattice 为 true 时坐标取少量离散值，制造大量等距点，检验 (距离, 编号) 排序；
+// 否则取连续值，距离计算有舍入
+void fill_row(std::mt19937_64& rng, bool lattice, double* row) {
+    std::uniform_real_distribution<double> uniform(0.0, 2.0);
+    for (int d = 0; d < N_FEATURES; d++) {
+        row[d] = lattice ? (double)(rng() % 8) * 0.25 : uniform(rng);
+    }
+}
+
+Dataset* make_dataset(size_t n, bool lattice, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    Dataset* dataset = new Dataset();
+    DatasetStorage::allocate(dataset, (int)n, N_FEATURES);
+    for (size_t i = 0; i < n; i++) {
+        fill_row(rng, lattice, dataset->matrix + i * N_FEATURES);
+        dataset->data[i].survived = (int)(rng() % 2);
+    }
+    return dataset;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 对未删除的点暴力求 k 近邻。单个点按步长 1 的一列交给块内核，舍入与索引内部一致
+int brute_force(const std::vector<double>& rows, const std::vector<char>& alive,
+                const double* query, int k, const double* weights, NeighborSet& scratch,
+                size_t* out_ids, double* out_distances) {
+    scratch.reset(k);
+    for (size_t id = 0; id < alive.size(); id++) {
+        if (!alive[id]) continue;
+        double dist;
+        MathUtils::squared_distances_block(query, rows.data() + id * N_FEATURES, 1, 1,
+                                           N_FEATURES, weights, &dist);
+        if (scratch.accepts(dist, id)) scratch.push(dist, id);
+    }
+    return scratch.extract(out_ids, out_distances);
+}
+
+// 跑一遍完整场景，返回核对失败的次数
+int run(bool lattice, size_t n_initial, size_t n_inserts, int n_readers, int k) {
+    const double weights[] = {2.0, 3.0, 1.5, 1.0, 1.0, 1.2, 0.5};
+    printf("== %s坐标 ==\n", lattice ? "离散" : "连续");
+
+    // 编号按分配顺序递增，这里按编号记下每个点的坐标和是否存活
+    std::vector<double> rows;
+    std::vector<char> alive;
+    std::mutex model_mutex;
+
+    DynamicKNNIndex index(N_FEATURES);
+    Dataset* initial = make_dataset(n_initial, lattice, 1);
+    rows.assign(initial->matrix, initial->matrix + n_initial * N_FEATURES);
+    alive.assign(n_initial, 1);
+
+    // load 分配编号后、建段完成前删除其中一部分：编号为 7 的倍数的点最终全部删除，
+    // 一部分由并发线程在 load 进行中删除，其余在 load 返回后补删
+    std::atomic<bool> loading(true);
+    std::atomic<size_t> removed_during_load(0);
+    std::thread early_remover([&] {
+        for (size_t id = 0; id < n_initial; id += 7) {
+            while (!index.remove(id)) {
+                if (!loading) return;
+            }
+            removed_during_load++;
+        }
+    });
+    auto load_start = std::chrono::steady_clock::now();
+    bool loaded = index.load(initial) != DynamicKNNIndex::INVALID_ID;
+    double load_seconds = seconds_since(load_start);
+    loading = false;
+    early_remover.join();
+    if (!loaded) {
+        DataLoader::free_dataset(initial);
+        return 1;
+    }
+    for (size_t id = 0; id < n_initial; id += 7) {
+        index.remove(id);
+        alive[id] = 0;
+    }
+    DataLoader::free_dataset(initial);
+    printf("load %zu 个点: %.3fs，其中 %zu 个在 load 进行中被删除\n",
+           n_initial, load_seconds, removed_during_load.load());
+
+    // 并发阶段：一个写线程插入并删除，若干读线程持续查询
+    std::atomic<bool> writing(true);
+    std::atomic<size_t> queries_done(0);
+    size_t removes_done = 0;
+    auto mixed_start = std::chrono::steady_clock::now();
+    std::thread writer([&] {
+        std::mt19937_64 rng(2);
+        double row[N_FEATURES];
+        for (size_t i = 0; i < n_inserts; i++) {
+            fill_row(rng, lattice, row);
+            {
+                // 先登记坐标再插入，编号与 rows 的下标一致
+                std::lock_guard<std::mutex> lock(model_mutex);
+                size_t id = index.insert(row, (int)(rng() % 2));
+                if (id != alive.size()) {
+                    printf("编号不连续: %zu\n", id);
+                    exit(1);
+                }
+                rows.insert(rows.end(), row, row + N_FEATURES);
+                alive.push_back(1);
+            }
+            if (i % REMOVE_EVERY == 0) {
+                std::lock_guard<std::mutex> lock(model_mutex);
+                size_t id = rng() % alive.size();
+                if (alive[id] && index.remove(id)) {
+                    alive[id] = 0;
+                    removes_done++;
+                }
+            }
+        }
+        writing = false;
+    });
+    std::vector<std::thread> readers;
+    for (int r = 0; r < n_readers; r++) {
+        readers.emplace_back([&, r] {
+            std::mt19937_64 rng(100 + r);
+            DynamicKNNIndex::Scratch scratch;
+            std::vector<size_t> ids(k);
+            double query[N_FEATURES];
+            size_t done = 0;
+            while (writing) {
+                fill_row(rng, lattice, query);
+                index.find_k_nearest(query, k, weights, scratch, ids.data());
+                done++;
+            }
+            queries_done += done;
+        });
+    }
+    writer.join();
+    for (std::thread& reader : readers) reader.join();
+    double mixed_seconds = seconds_since(mixed_start);
+    printf("并发阶段 %.3fs: 插入 %.0f/s，删除 %.0f/s，查询 %.0f/s（%d 个查询线程），段数 %zu\n",
+           mixed_seconds, n_inserts / mixed_seconds, removes_done / mixed_seconds,
+           queries_done / mixed_seconds, n_readers, index.segment_count());
+
+    // 核对：合并进行中和全部完成后各查一遍
+    int failures = 0;
+    size_t expected_size = 0;
+    for (char a : alive) expected_size += a;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) index.flush();
+        if (index.size() != expected_size) {
+            printf("size() = %zu，应为 %zu\n", index.size(), expected_size);
+            failures++;
+        }
+        std::mt19937_64 rng(3);
+        DynamicKNNIndex::Scratch scratch;
+        NeighborSet reference;
+        std::vector<size_t> got(k), want(k);
+        std::vector<double> got_dist(k), want_dist(k);
+        double query[N_FEATURES];
+        size_t mismatches = 0;
+        for (size_t q = 0; q < VERIFY_QUERIES; q++) {
+            fill_row(rng, lattice, query);
+            int a = index.find_k_nearest(query, k, weights, scratch, got.data(), got_dist.data());
+            int b = brute_force(rows, alive, query, k, weights, reference, want.data(),
+                                want_dist.data());
+            bool same = a == b;
+            for (int i = 0; same && i < a; i++) {
+                same = got[i] == want[i] && got_dist[i] == want_dist[i];
+            }
+            mismatches += !same;
+        }
+        printf("%s: %zu 个查询中 %zu 个与暴力搜索不一致，段数 %zu\n",
+               pass == 0 ? "flush 前" : "flush 后", VERIFY_QUERIES, mismatches,
+               index.segment_count());
+        failures += mismatches > 0;
+    }
+    return failures;
+}
+
+}
+
+int main(int argc, char** argv) {
+    size_t n_initial = argc > 1 ? strtoul(argv[1], nullptr, 10) : 50000;
+    size_t n_inserts = argc > 2 ? strtoul(argv[2], nullptr, 10) : 50000;
+    int n_readers = argc > 3 ? atoi(argv[3]) : 2;
+    int k = argc > 4 ? atoi(argv[4]) : 10;
+    if (n_initial == 0 || n_readers <= 0 || k <= 0) {
+        printf("参数无效\n");
+        return 1;
+    }
+#ifndef __FMA__
+    printf("注意：未开启 FMA 编译，连续坐标一遍无法检出乘加融合造成的舍入差异\n");
+#endif
+    int failures = run(true, n_initial, n_inserts, n_readers, k);
+    failures += run(false, n_initial, n_inserts, n_readers, k);
+    return failures ? 1 : 0;
+}
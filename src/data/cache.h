@@ -0,0 +1,243 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "loader.h"
+#include "process.h"
+#include "../utils/mapped_file.h"
+
+// 预处理后数据集的二进制缓存。文件布局（各段按 64 字节对齐，本机字节序）：
+//   DatasetCacheHeader
+//   行主序特征矩阵      n_samples × n_features 个 double
+//   标签               n_samples 个 int32
+//   PreprocessStats
+// 打开时直接映射文件，Dataset 的矩阵指向映射区，不做拷贝。
+// 源 CSV 的大小、修改时间或首尾内容摘要变化后，缓存自动失效。
+struct DatasetCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian_tag;
+    uint64_t header_size;
+    uint64_t n_samples;
+    uint64_t n_features;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_digest;
+    uint64_t matrix_offset;
+    uint64_t labels_offset;
+    uint64_t stats_offset;
+    uint64_t stats_size;
+    uint64_t file_size;
+};
+
+class DatasetCache {
+public:
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+
+    // 写入缓存（先写临时文件再改名，避免其他进程读到半个文件）
+    static bool save(const char* cache_path, const Dataset* dataset,
+                     const PreprocessStats& stats, const char* source_path) {
+        DatasetCacheHeader header;
+        if (!fill_source_info(source_path, &header)) return false;
+
+        uint64_t n = dataset->n_samples;
+        uint64_t d = dataset->n_features;
+        memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.endian_tag = ENDIAN_TAG;
+        header.header_size = sizeof(DatasetCacheHeader);
+        header.n_samples = n;
+        header.n_features = d;
+        header.matrix_offset = align(sizeof(DatasetCacheHeader));
+        header.labels_offset = align(header.matrix_offset + n * d * sizeof(double));
+        header.stats_offset = align(header.labels_offset + n * sizeof(int32_t));
+        header.stats_size = sizeof(PreprocessStats);
+        header.file_size = header.stats_offset + header.stats_size;
+
+        std::string tmp_path = std::string(cache_path) + ".tmp";
+        FILE* file = fopen(tmp_path.c_str(), "wb");
+        if (!file) return false;
+
+        bool ok = write_at(file, 0, &header, sizeof(header));
+        ok = ok && write_at(file, header.matrix_offset, dataset->matrix, n * d * sizeof(double));
+
+        std::vector<int32_t> labels(n);
+        for (uint64_t i = 0; i < n; i++) {
+            labels[i] = dataset->data[i].survived;
+        }
+        ok = ok && write_at(file, header.labels_offset, labels.data(), n * sizeof(int32_t));
+        ok = ok && write_at(file, header.stats_offset, &stats, sizeof(stats));
+        ok = fclose(file) == 0 && ok;
+
+        if (!ok) {
+            remove(tmp_path.c_str());
+            return false;
+        }
+        remove(cache_path);
+        return rename(tmp_path.c_str(), cache_path) == 0;
+    }
+
+    // 映射打开缓存。缓存不存在、版本不符或源文件已变化时返回 NULL；
+    // expected 非空时缓存中的统计量还必须与之相同（用训练集统计量变换的数据集）
+    static Dataset* open(const char* cache_path, const char* source_path,
+                         PreprocessStats* stats, const PreprocessStats* expected = nullptr) {
+        // 写时复制映射：之后若有人修改特征，不会写回缓存文件
+        MappedFile* file = new MappedFile(cache_path, true);
+        if (!file->is_open() || file->size() < sizeof(DatasetCacheHeader)) {
+            delete file;
+            return NULL;
+        }
+
+        DatasetCacheHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        DatasetCacheHeader source;
+        if (!fill_source_info(source_path, &source) || !header_valid(header, file->size()) ||
+            header.source_size != source.source_size ||
+            header.source_mtime_ns != source.source_mtime_ns ||
+            header.source_digest != source.source_digest ||
+            (expected && memcmp(expected, file->data() + header.stats_offset,
+                                sizeof(PreprocessStats)) != 0)) {
+            delete file;
+            return NULL;
+        }
+
+        char* base = file->mutable_data();
+        Dataset* dataset = new Dataset();
+        DatasetStorage::attach(dataset, (int)header.n_samples, (int)header.n_features,
+                               reinterpret_cast<double*>(base + header.matrix_offset),
+                               file, release_mapping);
+
+        const int32_t* labels = reinterpret_cast<const int32_t*>(base + header.labels_offset);
+        for (uint64_t i = 0; i < header.n_samples; i++) {
+            dataset->data[i].survived = labels[i];
+        }
+        if (stats) {
+            memcpy(stats, base + header.stats_offset, sizeof(PreprocessStats));
+        }
+        return dataset;
+    }
+
+    // 缓存有效时直接映射；否则解析 CSV、在其上拟合预处理统计量并变换，再重写缓存
+    static Dataset* load_or_build(const char* csv_path, const char* cache_path,
+                                  bool is_training, int num_threads,
+                                  PreprocessStats* stats) {
+        Dataset* dataset = open(cache_path, csv_path, stats);
+        if (dataset) return dataset;
+
+        dataset = DataLoader::load_csv_mapped(csv_path, is_training, num_threads);
+        if (!dataset) return NULL;
+
+        PreprocessStats fitted;
+        DataProcessor::fit_transform(dataset, &fitted, num_threads);
+        if (!save(cache_path, dataset, fitted, csv_path)) {
+            printf("警告：无法写入缓存文件 %s\n", cache_path);
+        }
+        if (stats) *stats = fitted;
+        return dataset;
+    }
+
+    // 同上，但用给定的统计量（通常来自训练集）变换，不在该数据集上拟合。
+    // 统计量变化后缓存失效
+    static Dataset* load_or_transform(const char* csv_path, const char* cache_path,
+                                      bool is_training, int num_threads,
+                                      const PreprocessStats& stats) {
+        Dataset* dataset = open(cache_path, csv_path, nullptr, &stats);
+        if (dataset) return dataset;
+
+        dataset = DataLoader::load_csv_mapped(csv_path, is_training, num_threads);
+        if (!dataset) return NULL;
+
+        DataProcessor::apply_stats(dataset, stats, num_threads);
+        if (!save(cache_path, dataset, stats, csv_path)) {
+            printf("警告：无法写入缓存文件 %s\n", cache_path);
+        }
+        return dataset;
+    }
+
+private:
+    static constexpr const char* MAGIC = "KNNDSET";
+    static constexpr uint64_t SECTION_ALIGNMENT = 64;
+    static constexpr size_t DIGEST_BYTES = 64 * 1024;
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    }
+
+    static void release_mapping(void* backing) {
+        delete static_cast<MappedFile*>(backing);
+    }
+
+    // 除固定字段外，逐段检查 [offset, offset + bytes) 按 64 字节对齐、依次排列且不越出文件，
+    // 截断或损坏的缓存不会让 open 读到映射区之外
+    static bool header_valid(const DatasetCacheHeader& header, size_t file_size) {
+        if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != VERSION ||
+            header.endian_tag != ENDIAN_TAG ||
+            header.header_size != sizeof(DatasetCacheHeader) ||
+            header.stats_size != sizeof(PreprocessStats) ||
+            header.file_size != file_size ||
+            header.n_features != FEATURE_COUNT ||
+            header.n_samples > (uint64_t)INT_MAX) {
+            return false;
+        }
+        // n_samples 和 n_features 已有上界，各段字节数不会溢出
+        uint64_t matrix_bytes = header.n_samples * header.n_features * sizeof(double);
+        uint64_t labels_bytes = header.n_samples * sizeof(int32_t);
+        return section_valid(header.matrix_offset, matrix_bytes, header.header_size, file_size) &&
+               section_valid(header.labels_offset, labels_bytes,
+                             header.matrix_offset + matrix_bytes, file_size) &&
+               section_valid(header.stats_offset, header.stats_size,
+                             header.labels_offset + labels_bytes, file_size);
+    }
+
+    // 段从 offset 开始、长 bytes 字节：须对齐，不早于上一段的末尾 previous_end，且不超出文件
+    static bool section_valid(uint64_t offset, uint64_t bytes, uint64_t previous_end,
+                              uint64_t file_size) {
+        return offset % SECTION_ALIGNMENT == 0 && offset >= previous_end &&
+               offset <= file_size && bytes <= file_size - offset;
+    }
+
+    // 源文件的大小、修改时间和首尾各 64KB 的 FNV-1a 摘要
+    static bool fill_source_info(const char* source_path, DatasetCacheHeader* header) {
+        memset(header, 0, sizeof(*header));
+        unsigned long long size;
+        long long mtime_ns;
+        if (!MappedFile::signature(source_path, &size, &mtime_ns)) return false;
+        header->source_size = size;
+        header->source_mtime_ns = mtime_ns;
+
+        MappedFile source(source_path);
+        if (!source.is_open()) return false;
+        uint64_t hash = 14695981039346656037ULL;
+        size_t head = std::min(source.size(), DIGEST_BYTES);
+        size_t tail_begin = std::max(head, source.size() - std::min(source.size(), DIGEST_BYTES));
+        hash = fnv1a(hash, source.data(), head);
+        hash = fnv1a(hash, source.data() + tail_begin, source.size() - tail_begin);
+        header->source_digest = hash;
+        return true;
+    }
+
+    static uint64_t fnv1a(uint64_t hash, const char* data, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static bool write_at(FILE* file, uint64_t offset, const void* data, size_t bytes) {
+#ifdef _WIN32
+        if (_fseeki64(file, (long long)offset, SEEK_SET) != 0) return false;
+#else
+        if (fseeko(file, (off_t)offset, SEEK_SET) != 0) return false;
+#endif
+        return bytes == 0 || fwrite(data, 1, bytes, file) == bytes;
+    }
+};
+
+#endif // CACHE_H
@@ -0,0 +1,114 @@
+#ifndef CSV_STREAM_H
+#define CSV_STREAM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "loader.h"
+
+// 流式 CSV 读取：用固定大小的缓冲区逐块读文件，每次取出至多 max_rows 行。
+// 内存占用只与缓冲区和块大小有关，与文件大小无关。
+class CsvStreamReader {
+public:
+    static constexpr size_t DEFAULT_BUFFER_BYTES = 1 << 20;
+
+    explicit CsvStreamReader(size_t buffer_bytes = DEFAULT_BUFFER_BYTES)
+        : file_(NULL), buffer_(buffer_bytes > 0 ? buffer_bytes : 1),
+          begin_(0), end_(0), eof_(false) {}
+
+    ~CsvStreamReader() {
+        close();
+    }
+
+    CsvStreamReader(const CsvStreamReader&) = delete;
+    CsvStreamReader& operator=(const CsvStreamReader&) = delete;
+
+    bool open(const char* filename) {
+        close();
+        file_ = fopen(filename, "rb");
+        if (!file_) {
+            printf("无法打开文件: %s\n", filename);
+            return false;
+        }
+        begin_ = end_ = 0;
+        eof_ = false;
+
+        const char* line_end;
+        if (!next_line(&line_end)) {
+            close();
+            return false;
+        }
+        DataLoader::ColumnIndices col_idx =
+            DataLoader::parse_header(std::string((const char*)buffer_.data() + begin_, line_end).c_str());
+        roles_ = DataLoader::column_roles(col_idx);
+        begin_ = line_end - buffer_.data() + (line_end < buffer_.data() + end_ ? 1 : 0);
+        return true;
+    }
+
+    void close() {
+        if (file_) fclose(file_);
+        file_ = NULL;
+    }
+
+    // 读取至多 max_rows 行到 out（先清空）；返回读到的行数，0 表示文件结束
+    size_t read_rows(size_t max_rows, DataLoader::ParsedChunk& out) {
+        out.clear();
+        while (file_ && out.rows() < max_rows) {
+            const char* line_end;
+            if (!next_line(&line_end)) break;
+
+            // 解析缓冲区中所有完整的行（文件末尾没有换行时包括最后一行）
+            const char* data = buffer_.data();
+            const char* limit = eof_ ? data + end_ : last_line_end(data + begin_, data + end_) + 1;
+            const char* stop = DataLoader::parse_chunk(data + begin_, limit, roles_, out,
+                                                       max_rows - out.rows());
+            begin_ = stop - data;
+        }
+        return out.rows();
+    }
+
+private:
+    FILE* file_;
+    std::vector<char> buffer_;
+    size_t begin_;                      // 未解析数据在缓冲区中的范围 [begin_, end_)
+    size_t end_;
+    bool eof_;
+    std::vector<int> roles_;
+
+    static const char* last_line_end(const char* begin, const char* end) {
+        for (const char* p = end; p > begin; p--) {
+            if (p[-1] == '\n') return p - 1;
+        }
+        return begin - 1;
+    }
+
+    // 保证缓冲区中至少有一整行（或文件剩余的全部内容）；没有数据时返回 false
+    bool next_line(const char** line_end) {
+        while (true) {
+            const char* data = buffer_.data();
+            const char* newline = static_cast<const char*>(
+                memchr(data + begin_, '\n', end_ - begin_));
+            if (newline) {
+                *line_end = newline;
+                return true;
+            }
+            if (eof_) {
+                *line_end = data + end_;
+                return begin_ < end_;
+            }
+
+            // 把未解析的尾部移到开头；一行比缓冲区还长时扩大缓冲区
+            memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+            if (end_ == buffer_.size()) {
+                buffer_.resize(buffer_.size() * 2);
+            }
+            size_t n = fread(buffer_.data() + end_, 1, buffer_.size() - end_, file_);
+            end_ += n;
+            if (n == 0) eof_ = true;
+        }
+    }
+};
+
+#endif // CSV_STREAM_H
@@ -8,18 +8,17 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
-
-// 基础数据结构
-typedef struct {
-    double* features;
-    int survived;
-} Sample;
-
-typedef struct {
-    Sample* data;
-    int n_samples;
-    int n_features;
-} Dataset;
+#include <string>
+// 浮点数的 std::from_chars 需要 libstdc++ 11（GCC 11）以上，更早的版本改用 strtod
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+#include "storage.h"
+#include "../utils/math.h"
+#include "../utils/mapped_file.h"
+#include "../utils/thread_pool.h"
 
 // 特征索引枚举
 enum TitanicFeatures {
@@ -34,6 +33,8 @@ enum TitanicFeatures {
 };
 
 class DataLoader {
+    friend class CsvStreamReader;
+
 private:
     // 添加列索引结构
     struct ColumnIndices {
@@ -45,6 +46,7 @@ private:
         int fare = -1;
         int embarked = -1;
         int survived = -1;
+        int passenger_id = -1;
     };
 
     static ColumnIndices parse_header(const char* header) {
@@ -76,6 +78,7 @@ private:
             else if (col == "fare") indices.fare = i;
             else if (col == "embarked") indices.embarked = i;
             else if (col == "survived") indices.survived = i;
+            else if (col == "passengerid") indices.passenger_id = i;
         }
 
         return indices;
@@ -90,7 +93,6 @@ public:
         }
 
         Dataset* dataset = new Dataset();
-        dataset->n_features = FEATURE_COUNT;
         
         // 读取并解析标题行
         char header[1024];
@@ -102,9 +104,8 @@ public:
         
         ColumnIndices col_idx = parse_header(header);
         
-        // 计算样本数量
-        dataset->n_samples = count_samples(file) - 1;
-        dataset->data = new Sample[dataset->n_samples];
+        // 计算样本数量，并一次性分配连续特征矩阵
+        DatasetStorage::allocate(dataset, count_samples(file) - 1, FEATURE_COUNT);
 
         // 重置文件指针到第二行
         rewind(file);
@@ -122,17 +123,269 @@ public:
         return dataset;
     }
 
+    // 单遍解析内存映射的 CSV：在映射的字节上直接切分行和字段，用 from_chars（或 strtod）解析数字。
+    // num_threads > 1 且文件较大时，按换行符把文件切成若干块并行解析。
+    // 分块假设引号字段内不含换行符（Titanic 数据满足）。
+    static Dataset* load_csv_mapped(const char* filename, bool is_training, int num_threads = 1) {
+        (void)is_training;
+        MappedFile file(filename);
+        if (!file.is_open()) {
+            printf("无法打开文件: %s\n", filename);
+            return NULL;
+        }
+
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+        if (begin == end) return NULL;
+
+        // 解析标题行
+        const char* header_end = find_line_end(begin, end);
+        ColumnIndices col_idx = parse_header(std::string(begin, header_end).c_str());
+        std::vector<int> roles = column_roles(col_idx);
+        const char* body = header_end < end ? header_end + 1 : end;
+
+        // 在换行符处切块
+        size_t n_chunks = 1;
+        if (num_threads > 1 && (size_t)(end - body) > PARALLEL_MIN_BYTES) {
+            n_chunks = (size_t)num_threads * 4;
+        }
+        std::vector<const char*> bounds(1, body);
+        for (size_t c = 1; c < n_chunks; c++) {
+            const char* p = std::max(body + (end - body) * c / n_chunks, bounds.back());
+            p = find_line_end(p, end);
+            bounds.push_back(p < end ? p + 1 : end);
+        }
+        bounds.push_back(end);
+
+        std::vector<ParsedChunk> chunks(n_chunks);
+        auto parse_range = [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                parse_chunk(bounds[c], bounds[c + 1], roles, chunks[c]);
+            }
+        };
+        if (n_chunks > 1) {
+            ThreadPool pool(num_threads);
+            pool.parallel_for(n_chunks, 1, parse_range);
+        } else {
+            parse_range(0, 1);
+        }
+
+        // 各块按顺序拼接进连续特征矩阵
+        size_t total = 0;
+        for (const auto& chunk : chunks) total += chunk.labels.size();
+
+        Dataset* dataset = new Dataset();
+        DatasetStorage::allocate(dataset, (int)total, FEATURE_COUNT);
+        size_t row = 0;
+        for (const auto& chunk : chunks) {
+            if (!chunk.labels.empty()) {
+                memcpy(dataset->matrix + row * FEATURE_COUNT, chunk.features.data(),
+                       chunk.features.size() * sizeof(double));
+            }
+            for (size_t i = 0; i < chunk.labels.size(); i++) {
+                dataset->data[row + i].survived = chunk.labels[i];
+            }
+            row += chunk.labels.size();
+        }
+        return dataset;
+    }
+
     static void free_dataset(Dataset* dataset) {
         if (!dataset) return;
         
-        for (int i = 0; i < dataset->n_samples; i++) {
-            delete[] dataset->data[i].features;
-        }
-        delete[] dataset->data;
+        DatasetStorage::release(dataset);
         delete dataset;
     }
 
 private:
+    // 小于该大小的文件不值得并行解析
+    static constexpr size_t PARALLEL_MIN_BYTES = 1 << 20;
+
+    // 列在解析时的用途：特征下标、存活标签、乘客编号或忽略
+    enum ColumnRole {
+        ROLE_SKIP = -1,
+        ROLE_SURVIVED = FEATURE_COUNT,
+        ROLE_PASSENGER_ID
+    };
+
+public:
+    // 解析出的一批行
+    struct ParsedChunk {
+        std::vector<double> features;   // 行主序，每行 FEATURE_COUNT 个值
+        std::vector<int> labels;
+        std::vector<long long> ids;     // PassengerId，缺失时为 -1
+
+        size_t rows() const { return labels.size(); }
+        void clear() {
+            features.clear();
+            labels.clear();
+            ids.clear();
+        }
+    };
+
+private:
+
+    static std::vector<int> column_roles(const ColumnIndices& col_idx) {
+        int columns[] = {
+            col_idx.pclass, col_idx.sex, col_idx.age, col_idx.sibsp,
+            col_idx.parch, col_idx.fare, col_idx.embarked, col_idx.survived,
+            col_idx.passenger_id
+        };
+        int n_columns = 0;
+        for (int c : columns) n_columns = std::max(n_columns, c + 1);
+
+        std::vector<int> roles(n_columns, ROLE_SKIP);
+        for (int role = 0; role <= ROLE_PASSENGER_ID; role++) {
+            if (columns[role] >= 0) roles[columns[role]] = role;
+        }
+        return roles;
+    }
+
+    static const char* find_line_end(const char* p, const char* end) {
+        const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        return newline ? newline : end;
+    }
+
+    // 查找未加引号字段的结尾（',' '\r' '\n'），x86 上每次比较 16 字节
+#ifdef KNN_X86_SIMD
+    __attribute__((target("sse2")))
+    static const char* find_field_end(const char* p, const char* end) {
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        while (end - p >= 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, comma),
+                           _mm_or_si128(_mm_cmpeq_epi8(bytes, cr), _mm_cmpeq_epi8(bytes, lf)));
+            int mask = _mm_movemask_epi8(hits);
+            if (mask) return p + __builtin_ctz(mask);
+            p += 16;
+        }
+        while (p < end && *p != ',' && *p != '\r' && *p != '\n') p++;
+        return p;
+    }
+#else
+    static const char* find_field_end(const char* p, const char* end) {
+        while (p < end && *p != ',' && *p != '\r' && *p != '\n') p++;
+        return p;
+    }
+#endif
+
+    static double parse_number(const char* begin, const char* end, double default_value) {
+        while (begin < end && *begin == ' ') begin++;
+        while (end > begin && end[-1] == ' ') end--;
+        if (begin < end && *begin == '+') begin++;
+        if (begin == end) return default_value;
+#ifdef __cpp_lib_to_chars
+        double value = default_value;
+        if (std::from_chars(begin, end, value).ec != std::errc()) {
+            return default_value;
+        }
+        return value;
+#else
+        // 字段不以 '\0' 结尾，复制到栈上再交给 strtod；输入不依赖 locale，按 C locale 解析
+        char buffer[64];
+        size_t n = (size_t)(end - begin);
+        if (n >= sizeof(buffer)) return default_value;
+        memcpy(buffer, begin, n);
+        buffer[n] = '\0';
+        char* parsed = NULL;
+        double value = strtod(buffer, &parsed);
+        return parsed == buffer + n ? value : default_value;
+#endif
+    }
+
+    static double parse_sex(const char* begin, const char* end) {
+        char buffer[8];
+        size_t n = 0;
+        for (const char* p = begin; p < end; p++) {
+            if (*p == ' ' || *p == '"') continue;
+            if (n == sizeof(buffer)) return 0.0;
+            buffer[n++] = (char)tolower((unsigned char)*p);
+        }
+        return (n == 4 && memcmp(buffer, "male", 4) == 0) ? 1.0 : 0.0;
+    }
+
+    static void store_field(int role, const char* begin, const char* end,
+                            double* row, int* label, long long* id) {
+        switch (role) {
+            case ROLE_SKIP: break;
+            case SEX: row[SEX] = parse_sex(begin, end); break;
+            case AGE: row[AGE] = parse_number(begin, end, -1.0); break;
+            case EMBARKED: row[EMBARKED] = parse_embarked(std::string(begin, end)); break;
+            case ROLE_SURVIVED: *label = (int)parse_number(begin, end, -1.0); break;
+            case ROLE_PASSENGER_ID: *id = (long long)parse_number(begin, end, -1.0); break;
+            default: row[role] = parse_number(begin, end, 0.0); break;
+        }
+    }
+
+    // 解析 [p, end) 中的完整行追加到 out，至多 max_rows 行；空行被跳过。
+    // 返回停止解析的位置。
+    static const char* parse_chunk(const char* p, const char* end, const std::vector<int>& roles,
+                                   ParsedChunk& out, size_t max_rows = (size_t)-1) {
+        int n_roles = (int)roles.size();
+        size_t parsed = 0;
+        while (p < end && parsed < max_rows) {
+            if (*p == '\n' || *p == '\r') {
+                p++;
+                continue;
+            }
+
+            size_t base = out.features.size();
+            out.features.resize(base + FEATURE_COUNT, 0.0);
+            double* row = out.features.data() + base;
+            row[AGE] = -1.0;
+            int label = -1;
+            long long id = -1;
+
+            for (int col = 0; ; col++) {
+                const char* field_begin;
+                const char* field_end;
+                if (p < end && *p == '"') {
+                    // 引号字段：内部的 "" 是转义的引号
+                    field_begin = ++p;
+                    field_end = end;
+                    while (p < end) {
+                        const char* quote = static_cast<const char*>(memchr(p, '"', end - p));
+                        if (!quote) {
+                            p = end;
+                            break;
+                        }
+                        p = quote + 1;
+                        if (p < end && *p == '"') {
+                            p++;
+                            continue;
+                        }
+                        field_end = quote;
+                        break;
+                    }
+                    p = find_field_end(p, end);
+                } else {
+                    field_begin = p;
+                    p = find_field_end(p, end);
+                    field_end = p;
+                }
+
+                if (col < n_roles) {
+                    store_field(roles[col], field_begin, field_end, row, &label, &id);
+                }
+
+                if (p < end && *p == ',') {
+                    p++;
+                    continue;
+                }
+                break;
+            }
+
+            p = find_line_end(p, end);
+            if (p < end) p++;
+            out.labels.push_back(label);
+            out.ids.push_back(id);
+            parsed++;
+        }
+        return p;
+    }
+
     static int count_samples(FILE* file) {
         int count = 0;
         char line[1024];
@@ -151,11 +404,8 @@ private:
         }
     }
 
+    // sample->features 已指向矩阵中清零的一行
     static void parse_line(const char* line, const ColumnIndices& col_idx, Sample* sample) {
-        sample->features = new double[FEATURE_COUNT];
-        for (int i = 0; i < FEATURE_COUNT; i++) {
-            sample->features[i] = 0.0;
-        }
 
         std::vector<std::string> tokens;
         std::string current;
@@ -5,83 +5,161 @@
 #include <cmath>
 #include <vector>
 
+// 预处理时拟合出的统计量，可随数据缓存一起保存
+struct PreprocessStats {
+    double age_fill;                    // 缺失年龄的填充值
+    double mean[FEATURE_COUNT];
+    double std_dev[FEATURE_COUNT];      // 为 0 表示该特征未做标准化
+};
+
+// 预处理分两步：fit 在训练集上一遍算出填充值和 z-score 统计量，
+// apply_stats 用这些统计量一遍完成填充和标准化，可用于训练集、测试集或流式数据块。
+// 负值视为缺失：年龄缺失时填充，其他特征的负值不参与统计也不做变换。
 class DataProcessor {
 public:
-    // 处理缺失值
-    static void handle_missing_values(Dataset* dataset) {
-        if (!dataset) return;
+    // 按固定大小的块扫描行主序矩阵：块内先求和得均值，再趁块还在缓存里求离差平方和
+    // （两趟都是无分支的累加，编译器可以向量化），各块再按顺序用 Chan 公式合并。
+    // 与 sum_sq/count - mean² 不同，数值稳定；分块与线程数无关，任何线程数下结果都逐位相同。
+    static void fit(const Dataset* dataset, PreprocessStats* stats, int num_threads = 1) {
+        *stats = PreprocessStats();
+        stats->age_fill = DEFAULT_AGE;
+        if (!dataset || dataset->n_samples == 0) return;
 
-        // 计算年龄平均值（忽略-1）
-        double age_sum = 0.0;
-        int age_count = 0;
-        for (int i = 0; i < dataset->n_samples; i++) {
-            if (dataset->data[i].features[AGE] >= 0) {
-                age_sum += dataset->data[i].features[AGE];
-                age_count++;
+        size_t n = dataset->n_samples;
+        size_t n_chunks = (n + FIT_CHUNK - 1) / FIT_CHUNK;
+        std::vector<Moments> partial(n_chunks * FEATURE_COUNT);
+        auto fit_range = [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                accumulate(dataset, c * FIT_CHUNK, std::min(n, (c + 1) * FIT_CHUNK),
+                           &partial[c * FEATURE_COUNT]);
             }
+        };
+        if (num_threads > 1 && n_chunks > 1) {
+            ThreadPool pool(num_threads);
+            pool.parallel_for(n_chunks, 1, fit_range);
+        } else {
+            fit_range(0, n_chunks);
         }
-        double mean_age = age_count > 0 ? age_sum / age_count : 30.0;
 
-        // 填充缺失值
-        for (int i = 0; i < dataset->n_samples; i++) {
-            // 年龄缺失用平均值填充
-            if (dataset->data[i].features[AGE] < 0) {
-                dataset->data[i].features[AGE] = mean_age;
+        Moments total[FEATURE_COUNT] = {};
+        for (size_t c = 0; c < n_chunks; c++) {
+            for (int f = 0; f < FEATURE_COUNT; f++) {
+                total[f].merge(partial[c * FEATURE_COUNT + f]);
             }
         }
-    }
-
-    // 标准化数据集
-    static void normalize_dataset(Dataset* dataset) {
-        if (!dataset) return;
 
-        // 对每个特征分别处理
-        for (int feature = 0; feature < dataset->n_features; feature++) {
-            // 跳过不需要标准化的分类特征
-            if (feature == SEX || feature == EMBARKED) {
-                continue;  // 这些特征保持原值
+        for (int f = 0; f < FEATURE_COUNT; f++) {
+            if (!NORMALIZED[f] || total[f].count == 0) continue;
+            double m2 = total[f].m2;
+            double count = total[f].count;
+            if (f == AGE) {
+                // 缺失年龄先用均值填充再标准化：填充值与均值的偏差为 0，只增加样本数
+                stats->age_fill = total[f].mean;
+                count = (double)n;
             }
+            double std_dev = sqrt(m2 / count);
+            stats->mean[f] = total[f].mean;
+            stats->std_dev[f] = std_dev > 0 ? std_dev : 0.0;
+        }
+    }
 
-            // 对数值型特征进行标准化
-            if (feature == PCLASS || feature == AGE || feature == SIBSP || 
-                feature == PARCH || feature == FARE) {
-                normalize_numeric_feature(dataset, feature);
+    // 用已拟合的统计量（通常来自训练集）处理任意数据集或流式数据块：
+    // 填充缺失年龄，再对 std_dev > 0 的特征做 z-score。按行原地处理，一遍完成。
+    static void apply_stats(Dataset* dataset, const PreprocessStats& stats, int num_threads = 1) {
+        if (!dataset) return;
+        auto transform = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                double* row = dataset->matrix + i * dataset->n_features;
+                if (row[AGE] < 0) {
+                    row[AGE] = stats.age_fill;
+                }
+                for (int f = 0; f < FEATURE_COUNT; f++) {
+                    if (stats.std_dev[f] > 0 && row[f] >= 0) {
+                        row[f] = (row[f] - stats.mean[f]) / stats.std_dev[f];
+                    }
+                }
             }
+        };
+        size_t n = dataset->n_samples;
+        if (num_threads > 1 && n > FIT_CHUNK) {
+            ThreadPool pool(num_threads);
+            pool.parallel_for(n, FIT_CHUNK, transform);
+        } else {
+            transform(0, n);
         }
     }
 
+    // 在数据集自身上拟合并原地变换；stats 非空时记录拟合结果
+    static void fit_transform(Dataset* dataset, PreprocessStats* stats = nullptr,
+                              int num_threads = 1) {
+        if (!dataset) return;
+        PreprocessStats fitted;
+        fit(dataset, &fitted, num_threads);
+        apply_stats(dataset, fitted, num_threads);
+        if (stats) *stats = fitted;
+    }
+
 private:
-    // 标准化数值型特征
-    static void normalize_numeric_feature(Dataset* dataset, int feature_idx) {
-        double sum = 0.0, sum_sq = 0.0;
-        int count = 0;
+    static constexpr double DEFAULT_AGE = 30.0;    // 没有任何年龄记录时的填充值
+    static constexpr size_t FIT_CHUNK = 4096;      // 一块约 224KB，第二趟仍命中缓存
 
-        // 计算均值和标准差
-        for (int i = 0; i < dataset->n_samples; i++) {
-            double value = dataset->data[i].features[feature_idx];
-            if (value >= 0) {  // 忽略缺失值
-                sum += value;
-                sum_sq += value * value;
-                count++;
+    // 需要标准化的数值特征；性别和登船港口保持原值
+    static constexpr bool NORMALIZED[FEATURE_COUNT] = {
+        true,   // PCLASS
+        false,  // SEX
+        true,   // AGE
+        true,   // SIBSP
+        true,   // PARCH
+        true,   // FARE
+        false   // EMBARKED
+    };
+
+    // 一组样本的个数、均值和离差平方和
+    struct Moments {
+        double count;
+        double mean;
+        double m2;
+
+        void merge(const Moments& other) {
+            if (other.count == 0) return;
+            if (count == 0) {
+                *this = other;
+                return;
             }
+            double total = count + other.count;
+            double delta = other.mean - mean;
+            mean += delta * other.count / total;
+            m2 += other.m2 + delta * delta * count * other.count / total;
+            count = total;
         }
+    };
 
-        if (count > 0) {
-            double mean = sum / count;
-            double variance = (sum_sq / count) - (mean * mean);
-            double std_dev = sqrt(variance);
-
-            // 避免除以零
-            if (std_dev > 0) {
-                // 进行标准化 (z-score)
-                for (int i = 0; i < dataset->n_samples; i++) {
-                    if (dataset->data[i].features[feature_idx] >= 0) {
-                        dataset->data[i].features[feature_idx] = 
-                            (dataset->data[i].features[feature_idx] - mean) / std_dev;
-                    }
-                }
+    static void accumulate(const Dataset* dataset, size_t begin, size_t end, Moments* moments) {
+        double count[FEATURE_COUNT] = {}, sum[FEATURE_COUNT] = {}, m2[FEATURE_COUNT] = {};
+        for (size_t i = begin; i < end; i++) {
+            const double* row = dataset->matrix + i * dataset->n_features;
+            for (int f = 0; f < FEATURE_COUNT; f++) {
+                bool present = row[f] >= 0;
+                count[f] += present;
+                sum[f] += present ? row[f] : 0.0;
+            }
+        }
+        double mean[FEATURE_COUNT];
+        for (int f = 0; f < FEATURE_COUNT; f++) {
+            mean[f] = count[f] > 0 ? sum[f] / count[f] : 0.0;
+        }
+        for (size_t i = begin; i < end; i++) {
+            const double* row = dataset->matrix + i * dataset->n_features;
+            for (int f = 0; f < FEATURE_COUNT; f++) {
+                double delta = row[f] >= 0 ? row[f] - mean[f] : 0.0;
+                m2[f] += delta * delta;
             }
         }
+        for (int f = 0; f < FEATURE_COUNT; f++) {
+            moments[f].count = count[f];
+            moments[f].mean = mean[f];
+            moments[f].m2 = m2[f];
+        }
     }
 };
 
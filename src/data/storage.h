@@ -0,0 +1,98 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <new>
+#include "../utils/arena.h"
+
+// 对齐分配（std::align_val_t）、inline 静态成员和十六进制浮点字面量都需要 C++17
+#if (defined(_MSVC_LANG) ? _MSVC_LANG : __cplusplus) < 201703L
+#error "需要 C++17：请用 -std=c++17（或 -std=gnu++17）编译"
+#endif
+
+// 基础数据结构
+typedef struct {
+    double* features;   // 指向 Dataset::matrix 中对应的行
+    int survived;
+} Sample;
+
+typedef struct {
+    Sample* data;
+    int n_samples;
+    int n_features;
+    double* matrix;     // 行主序连续特征矩阵（n_samples × n_features，64 字节对齐）
+    Arena* arena;       // 样本数组和自有矩阵都从这里分配，释放时整体归还
+    void* backing;      // 非空时 matrix 指向外部内存（如映射的缓存文件）
+    void (*release_backing)(void* backing);
+} Dataset;
+
+// 数据集存储：所有样本的特征放在同一块对齐的连续内存中，
+// 数据集自有的内存全部来自一个内存池，建立和释放都只有常数次系统分配
+class DatasetStorage {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    static double* alloc_aligned(size_t count) {
+        size_t bytes = (count ? count : 1) * sizeof(double);
+        bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        return static_cast<double*>(::operator new[](bytes, std::align_val_t(ALIGNMENT)));
+    }
+
+    static void free_aligned(double* ptr) {
+        if (ptr) ::operator delete[](ptr, std::align_val_t(ALIGNMENT));
+    }
+
+    // 为数据集分配特征矩阵和样本数组，特征清零
+    static void allocate(Dataset* dataset, int n_samples, int n_features) {
+        size_t n = n_samples > 0 ? n_samples : 1;
+        size_t matrix_bytes = n * n_features * sizeof(double);
+        dataset->n_samples = n_samples;
+        dataset->n_features = n_features;
+        dataset->arena = new Arena(matrix_bytes + n * sizeof(Sample) + 4 * ALIGNMENT);
+        dataset->matrix = dataset->arena->allocate_array<double>(n * n_features);
+        memset(dataset->matrix, 0, matrix_bytes);
+        dataset->backing = NULL;
+        dataset->release_backing = NULL;
+        dataset->data = dataset->arena->allocate_array<Sample>(n);
+        for (int i = 0; i < n_samples; i++) {
+            dataset->data[i].features = dataset->matrix + (size_t)i * n_features;
+            dataset->data[i].survived = -1;
+        }
+    }
+
+    // 让数据集直接使用外部内存中的矩阵，不做拷贝；释放时调用 release_backing
+    static void attach(Dataset* dataset, int n_samples, int n_features,
+                       double* matrix, void* backing, void (*release_backing)(void*)) {
+        dataset->n_samples = n_samples;
+        dataset->n_features = n_features;
+        dataset->matrix = matrix;
+        dataset->backing = backing;
+        dataset->release_backing = release_backing;
+        size_t n = n_samples > 0 ? n_samples : 1;
+        dataset->arena = new Arena(n * sizeof(Sample) + 2 * ALIGNMENT);
+        dataset->data = dataset->arena->allocate_array<Sample>(n);
+        for (int i = 0; i < n_samples; i++) {
+            dataset->data[i].features = matrix + (size_t)i * n_features;
+            dataset->data[i].survived = -1;
+        }
+    }
+
+    // 释放矩阵和样本数组（不释放 Dataset 本身）
+    static void release(Dataset* dataset) {
+        if (dataset->backing) {
+            dataset->release_backing(dataset->backing);
+        }
+        delete dataset->arena;
+        dataset->arena = NULL;
+        dataset->backing = NULL;
+        dataset->matrix = NULL;
+        dataset->data = NULL;
+    }
+
+    static const double* row(const Dataset* dataset, size_t i) {
+        return dataset->matrix + i * dataset->n_features;
+    }
+};
+
+#endif // STORAGE_H
@@ -1,7 +1,12 @@
 #include "data/loader.h"
 #include "data/process.h"
+#include "data/cache.h"
 #include "model/predictor.h"
+#include "model/streaming.h"
 #include "model/weights.h"
+#include "model/grid_search.h"
+#include "utils/alloc_counter.h"
+#include <string.h>
 #include <chrono>
 #include <fstream>
 #include <iomanip>
@@ -36,31 +41,66 @@ double calculate_accuracy(const std::vector<int>& predictions, const char* truth
     return total > 0 ? (double)correct / total : 0.0;
 }
 
-int main() {
+int main(int argc, char** argv) {
     printf("=== 泰坦尼克号生存预测 ===\n\n");
 
+    // 流式模式：main --stream [输入CSV] [输出CSV]
+    // 调参模式：main --tune [折数] [k_max]，在训练集上交叉验证搜索 k 和特征权重
+    // 分片服务：main --serve-shard 套接字 分片号 分片数，为训练集的一段提供查询服务
+    // 远程分片：main --shards 套接字1 套接字2 ...，预测时查询这些分片服务
+    bool streaming = argc > 1 && strcmp(argv[1], "--stream") == 0;
+    bool tuning = argc > 1 && strcmp(argv[1], "--tune") == 0;
+    bool serving = argc > 4 && strcmp(argv[1], "--serve-shard") == 0;
+    bool remote_shards = argc > 2 && strcmp(argv[1], "--shards") == 0;
+    int tune_folds = tuning && argc > 2 ? atoi(argv[2]) : 5;
+    int tune_k_max = tuning && argc > 3 ? atoi(argv[3]) : 25;
+    const char* stream_input = streaming && argc > 2 ? argv[2] : "../data/test.csv";
+    const char* stream_output = streaming && argc > 3 ? argv[3] : "predictions.csv";
+    const int k = 5;
+
     auto total_start = TIME_NOW;
 
-    // 1. 加载数据
+    // 1. 加载并预处理数据：缓存有效时直接映射，否则解析 CSV 后写入缓存。
+    //    测试集用训练集拟合出的统计量变换，两者处在同一坐标系下
     auto load_start = TIME_NOW;
-    Dataset* train_data = DataLoader::load_csv("../data/train.csv", true);
-    Dataset* test_data = DataLoader::load_csv("../data/test.csv", false);
-    printf("数据加载耗时: %ldms\n", DURATION(load_start));
-
-    if (!train_data || !test_data) {
+    int n_threads = ThreadPool::default_threads();
+    PreprocessStats train_stats;
+    Dataset* train_data = DatasetCache::load_or_build(
+        "../data/train.csv", "../data/train.csv.knncache", true, n_threads, &train_stats);
+    Dataset* test_data = streaming || tuning || serving || !train_data ? nullptr : DatasetCache::load_or_transform(
+        "../data/test.csv", "../data/test.csv.knncache", false, n_threads, train_stats);
+    printf("数据加载与预处理耗时: %ldms\n", DURATION(load_start));
+
+    if (!train_data || (!streaming && !tuning && !serving && !test_data)) {
         printf("数据加载失败\n");
         return 1;
     }
 
-    // 2. 数据预处理
-    auto preprocess_start = TIME_NOW;
-    DataProcessor::handle_missing_values(train_data);
-    DataProcessor::handle_missing_values(test_data);
-    DataProcessor::normalize_dataset(train_data);
-    DataProcessor::normalize_dataset(test_data);
-    printf("数据预处理耗时: %ldms\n", DURATION(preprocess_start));
+    // 分片服务：分片按序号轮流放到各 NUMA 节点上，服务直到客户端请求关闭
+    if (serving) {
+        int shard = atoi(argv[3]);
+        int n_shards = atoi(argv[4]);
+        if (n_shards <= 0 || shard < 0 || shard >= n_shards) {
+            printf("分片参数无效\n");
+            DataLoader::free_dataset(train_data);
+            return 1;
+        }
+        std::vector<std::vector<int>> nodes = NumaTopology::nodes();
+        const std::vector<int>& cpus = nodes[shard % nodes.size()];
+        size_t n = train_data->n_samples;
+        bool ok;
+        {
+            LocalShard local(train_data, n * shard / n_shards, n * (shard + 1) / n_shards,
+                             cpus, (int)cpus.size());
+            printf("分片 %d/%d: 训练点 [%zu, %zu)，监听 %s\n", shard, n_shards, local.offset(),
+                   local.offset() + local.size(), argv[2]);
+            ok = ShardServer::serve(argv[2], local);
+        }
+        DataLoader::free_dataset(train_data);
+        return ok ? 0 : 1;
+    }
 
-    // 3. 特征权重计算
+    // 2. 特征权重计算
     auto weight_start = TIME_NOW;
     double custom_weights[] = {
         2.0,  // Pclass
@@ -75,19 +115,109 @@ int main() {
     double* weights = WeightCalculator::set_custom_weights(custom_weights, FEATURE_COUNT);
     printf("特征权重计算耗时: %ldms\n", DURATION(weight_start));
 
-    // 4. 模型训练
+    // 调参模式：每维权重在当前值的 0.5/1/2 倍中取，与 k = 1..k_max 组成网格
+    if (tuning) {
+        auto tune_start = TIME_NOW;
+        std::vector<std::vector<double>> values(FEATURE_COUNT);
+        for (int f = 0; f < FEATURE_COUNT; f++) {
+            values[f] = {weights[f] * 0.5, weights[f], weights[f] * 2.0};
+        }
+        std::vector<std::vector<double>> candidates = GridSearch::cartesian(values);
+        GridSearch search(train_data, tune_folds, 1, n_threads);
+        std::vector<double> accuracy = search.evaluate(candidates, tune_k_max);
+        delete[] weights;
+        DataLoader::free_dataset(train_data);
+        if (accuracy.empty()) {
+            printf("交叉验证失败\n");
+            return 1;
+        }
+
+        // 当前配置（每维 1 倍）在网格正中
+        size_t current = (candidates.size() - 1) / 2;
+        GridSearchResult best = GridSearch::best(accuracy, tune_k_max);
+        printf("交叉验证: %d 折, %zu 组权重 × k = 1..%d，耗时: %ldms\n", search.n_folds(),
+               candidates.size(), tune_k_max, DURATION(tune_start));
+        if (k <= tune_k_max) {
+            printf("当前配置 (k=%d) 准确率: %.2f%%\n", k,
+                   accuracy[current * tune_k_max + (k - 1)] * 100);
+        }
+        printf("最佳配置 (k=%d) 准确率: %.2f%%，权重:", best.k, best.accuracy * 100);
+        for (int f = 0; f < FEATURE_COUNT; f++) {
+            printf(" %s=%.2f", WeightCalculator::get_feature_name(f), candidates[best.weight_index][f]);
+        }
+        printf("\n总耗时: %ldms\n", DURATION(total_start));
+        return 0;
+    }
+
+    // 3. 模型训练
     auto train_start = TIME_NOW;
-    Predictor predictor(train_data, weights);
+    Predictor predictor(train_data, weights, "../data/train.csv.kdindex");
+    predictor.set_num_threads(n_threads);
+    if (remote_shards) {
+        std::vector<std::string> paths(argv + 2, argv + argc);
+        ShardedIndex* index = ShardedIndex::connect(paths, train_data);
+        if (!index) {
+            printf("分片服务与训练集不一致\n");
+            delete[] weights;
+            DataLoader::free_dataset(train_data);
+            DataLoader::free_dataset(test_data);
+            return 1;
+        }
+        predictor.set_sharded_index(index);
+    }
     printf("模型训练耗时: %ldms\n", DURATION(train_start));
+    printf("搜索引擎: %s\n", Predictor::engine_name(predictor.engine()));
+
+    // 流式模式：分块读取、用训练集统计量预处理、边预测边写出
+    if (streaming) {
+        auto stream_start = TIME_NOW;
+        StreamingPredictor streamer(&predictor, train_stats, k);
+        long long rows = streamer.run(stream_input, stream_output);
+        printf("流式预测 %lld 行，耗时: %ldms\n", rows, DURATION(stream_start));
+        printf("总耗时: %ldms\n", DURATION(total_start));
+
+        delete[] weights;
+        DataLoader::free_dataset(train_data);
+        return rows < 0 ? 1 : 0;
+    }
 
-    // 5. 预测
+    // 4. 预测
     auto predict_start = TIME_NOW;
+    AllocationStats before_predict = AllocationCounters::snapshot();
     std::vector<int> predictions;
-    std::vector<std::vector<size_t>> all_neighbors;
-    predictor.predict_with_neighbors(test_data, 5, predictions, all_neighbors);
+    NeighborMatrix all_neighbors;
+    if (!predictor.predict_with_neighbors(test_data, k, predictions, all_neighbors)) {
+        printf("预测失败\n");
+        delete[] weights;
+        DataLoader::free_dataset(train_data);
+        DataLoader::free_dataset(test_data);
+        return 1;
+    }
     printf("预测耗时: %ldms\n", DURATION(predict_start));
+    if (AllocationCounters::heap_counting_enabled()) {
+        AllocationStats after_predict = AllocationCounters::snapshot();
+        printf("预测期间堆分配: %llu 次，%llu 字节\n",
+               after_predict.heap_allocations - before_predict.heap_allocations,
+               after_predict.heap_bytes - before_predict.heap_bytes);
+    }
+    if (SearchStats::enabled()) {
+        const LogHistogram& latency = SearchStats::query_latency();
+        printf("查询延迟: p50 %lluns, p99 %lluns, 最大 %lluns; 平均每次搜索计算 %.1f 个距离\n",
+               (unsigned long long)latency.percentile(0.5),
+               (unsigned long long)latency.percentile(0.99), (unsigned long long)latency.max(),
+               SearchStats::searches() ?
+                   (double)SearchStats::distance_evaluations() / SearchStats::searches() : 0.0);
+        const LogHistogram& chunks = SearchStats::chunk_latency();
+        if (chunks.count() > 0) {
+            printf("批量块延迟: %llu 块共 %llu 条查询, p50 %lluns, p99 %lluns, 最大 %lluns\n",
+                   (unsigned long long)chunks.count(), SearchStats::chunk_queries(),
+                   (unsigned long long)chunks.percentile(0.5),
+                   (unsigned long long)chunks.percentile(0.99), (unsigned long long)chunks.max());
+        }
+        SearchStats::dump_json("search_stats.json");
+    }
 
-    // 6. 计算准确率
+    // 5. 计算准确率
     double accuracy = calculate_accuracy(predictions, "../data/gender_submission.csv");
     printf("\n预测准确率: %.2f%%\n", accuracy * 100);
     printf("总耗时: %ldms\n", DURATION(total_start));
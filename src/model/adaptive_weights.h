@@ -2,55 +2,129 @@
 #define ADAPTIVE_WEIGHTS_H
 
 #include <vector>
+#include <memory>
 #include <cmath>
 #include "../data/loader.h"
 
-class AdaptiveWeights {
+// 一次发布的权重，发布后不再修改，读者可以在整批查询中持有
+struct WeightSnapshot {
+    std::vector<double> weights;
+    unsigned long long version;     // 每发布一次加 1
+};
+
+// 一批查询的特征反馈计数。各线程先累加到自己的计数里，再合并到批次总数
+class FeedbackAccumulator {
 public:
-    AdaptiveWeights(int n_features) 
-        : weights_(n_features, 1.0),
-          feature_success_(n_features, 0),
-          feature_used_(n_features, 0) {}
+    explicit FeedbackAccumulator(int n_features = 0)
+        : success_(n_features, 0), used_(n_features, 0) {}
 
-    // 更新权重
-    void update(const double* query, const std::vector<size_t>& neighbors,
-                const Dataset* train_data, bool correct_prediction) {
-        for (int f = 0; f < weights_.size(); f++) {
-            bool feature_helpful = is_feature_helpful(f, query, neighbors, train_data);
-            feature_used_[f]++;
-            
+    void reset(int n_features) {
+        success_.assign(n_features, 0);
+        used_.assign(n_features, 0);
+    }
+
+    // 记录一条已知结果的查询：每个特征是否“有帮助”与预测是否正确一致时记一次成功
+    void add(const double* query, const size_t* neighbors, int count,
+             const Dataset* train_data, bool correct_prediction) {
+        for (size_t f = 0; f < used_.size(); f++) {
+            bool feature_helpful = is_feature_helpful((int)f, query, neighbors, count, train_data);
+            used_[f]++;
             if (feature_helpful == correct_prediction) {
-                feature_success_[f]++;
+                success_[f]++;
             }
-            
-            // 更新权重：成功率 * 2 + 0.5
-            weights_[f] = (feature_success_[f] / (double)feature_used_[f]) * 2.0 + 0.5;
         }
     }
 
-    const std::vector<double>& get_weights() const {
-        return weights_;
+    // 并入 other 的计数并将其清零
+    void merge(FeedbackAccumulator& other) {
+        for (size_t f = 0; f < used_.size(); f++) {
+            success_[f] += other.success_[f];
+            used_[f] += other.used_[f];
+            other.success_[f] = 0;
+            other.used_[f] = 0;
+        }
     }
 
 private:
-    std::vector<double> weights_;
-    std::vector<int> feature_success_;
-    std::vector<int> feature_used_;
+    friend class AdaptiveWeights;
+
+    std::vector<int> success_;
+    std::vector<int> used_;
 
-    bool is_feature_helpful(int feature_idx, const double* query,
-                          const std::vector<size_t>& neighbors,
-                          const Dataset* train_data) {
+    static bool is_feature_helpful(int feature_idx, const double* query,
+                                   const size_t* neighbors, int count,
+                                   const Dataset* train_data) {
         // 计算查询点与邻居在该特征上的平均差异
         double avg_diff = 0.0;
-        for (size_t idx : neighbors) {
-            avg_diff += std::abs(query[feature_idx] - 
-                      train_data->data[idx].features[feature_idx]);
+        for (int i = 0; i < count; i++) {
+            avg_diff += std::abs(query[feature_idx] -
+                      DatasetStorage::row(train_data, neighbors[i])[feature_idx]);
         }
-        avg_diff /= neighbors.size();
-        
+        avg_diff /= count;
+
         // 如果差异小，认为该特征有帮助
         return avg_diff < 0.5;
     }
 };
 
+// 自适应特征权重：权重 = 成功率 * 2 + 0.5。
+// 逐条模式用 update 就地修改权重；小批量模式中查询读取 snapshot() 得到的冻结权重，
+// 整批反馈汇总后用 apply 一次更新，并原子地发布新快照，读者不会看到更新到一半的权重。
+class AdaptiveWeights {
+public:
+    AdaptiveWeights(int n_features)
+        : weights_(n_features, 1.0),
+          feedback_(n_features),
+          stale_(true) {
+        publish();
+    }
+
+    // 更新权重（逐条模式，不发布快照）
+    void update(const double* query, const std::vector<size_t>& neighbors,
+                const Dataset* train_data, bool correct_prediction) {
+        feedback_.add(query, neighbors.data(), (int)neighbors.size(), train_data, correct_prediction);
+        recompute();
+    }
+
+    // 并入一批反馈（batch 随后被清零），重算权重并发布新快照
+    void apply(FeedbackAccumulator& batch) {
+        feedback_.merge(batch);
+        recompute();
+        publish();
+    }
+
+    // 权重在上次发布后有变化（例如逐条 update 过）时发布当前权重
+    void publish() {
+        if (!stale_) return;
+        auto next = std::make_shared<WeightSnapshot>();
+        next->weights = weights_;
+        next->version = published_ ? published_->version + 1 : 0;
+        std::atomic_store(&published_, std::shared_ptr<const WeightSnapshot>(std::move(next)));
+        stale_ = false;
+    }
+
+    const std::vector<double>& get_weights() const {
+        return weights_;
+    }
+
+    // 最近一次发布的权重，可与 apply 并发调用
+    std::shared_ptr<const WeightSnapshot> snapshot() const {
+        return std::atomic_load(&published_);
+    }
+
+private:
+    std::vector<double> weights_;
+    FeedbackAccumulator feedback_;      // 累计的成功次数和使用次数
+    std::shared_ptr<const WeightSnapshot> published_;
+    bool stale_;
+
+    void recompute() {
+        for (size_t f = 0; f < weights_.size(); f++) {
+            if (feedback_.used_[f] == 0) continue;
+            weights_[f] = (feedback_.success_[f] / (double)feedback_.used_[f]) * 2.0 + 0.5;
+        }
+        stale_ = true;
+    }
+};
+
 #endif // ADAPTIVE_WEIGHTS_H 
\ No newline at end of file
@@ -0,0 +1,281 @@
+#ifndef BALL_TREE_H
+#define BALL_TREE_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include "../utils/math.h"
+#include "../data/loader.h"
+#include "spatial_index.h"
+
+// 球树节点：覆盖 perm_[begin, end) 的点，中心存放在 centers_ 的第 node 行
+struct BallNode {
+    double radius;          // 构建度量下到中心的最大距离（非平方）
+    uint32_t begin;
+    uint32_t end;
+    int32_t left;           // 子节点下标，叶子为 -1
+    int32_t right;
+};
+
+// 球树索引。每个节点沿两个相距最远的点的连线方向按中位数一分为二，
+// 分割面不必与坐标轴平行，对取值离散的类别特征和连续特征混合的数据比 KD 树更贴合。
+// 半径按构建时的权重计算；查询权重不同时半径乘以 sqrt(max(w查询 / w构建)) 放大，
+// 下界依然成立，所以任何非负权重下结果都是精确的（与暴力搜索和未预缩放的 KD 树逐位相同），
+// 只是权重偏离越远剪枝越弱。
+class BallTree : public SpatialIndex {
+public:
+    static constexpr int DEFAULT_LEAF_SIZE = 32;
+    static constexpr int MAX_LEAF_SIZE = 256;
+    static constexpr int MAX_DEPTH = 64;    // 按中位数分割，深度不超过 log2(点数) + 1
+    static constexpr int SMALL_K = 16;      // k 不超过该值时候选集合放在栈上
+
+    // build_weights 为空时按普通欧氏距离建树
+    explicit BallTree(const Dataset* dataset, const double* build_weights = nullptr,
+                      int leaf_size = DEFAULT_LEAF_SIZE)
+        : dataset_(dataset), n_features_(dataset ? dataset->n_features : 0),
+          n_points_(dataset ? dataset->n_samples : 0),
+          leaf_size_(std::min(std::max(1, leaf_size), (int)MAX_LEAF_SIZE)),
+          depth_(0), columns_(nullptr) {
+        if (n_points_ == 0) return;
+
+        build_weights_.assign(n_features_, 1.0);
+        if (build_weights) {
+            for (int d = 0; d < n_features_; d++) {
+                build_weights_[d] = std::max(build_weights[d], 0.0);
+            }
+        }
+        perm_.resize(n_points_);
+        for (size_t i = 0; i < n_points_; i++) {
+            perm_[i] = (uint32_t)i;
+        }
+        std::vector<double> projection(n_points_);
+        build(0, n_points_, 0, projection);
+
+        // 按叶子顺序重排坐标并转为列主序，叶子扫描复用 SIMD 块内核
+        columns_ = DatasetStorage::alloc_aligned(n_points_ * n_features_);
+        for (size_t i = 0; i < n_points_; i++) {
+            const double* row = DatasetStorage::row(dataset_, perm_[i]);
+            for (int d = 0; d < n_features_; d++) {
+                columns_[(size_t)d * n_points_ + i] = row[d];
+            }
+        }
+    }
+
+    ~BallTree() {
+        DatasetStorage::free_aligned(columns_);
+    }
+
+    BallTree(const BallTree&) = delete;
+    BallTree& operator=(const BallTree&) = delete;
+
+    const char* name() const override { return "ball-tree"; }
+    size_t size() const override { return n_points_; }
+    int n_features() const override { return n_features_; }
+
+    IndexStats stats() const override {
+        IndexStats stats;
+        stats.points = n_points_;
+        stats.nodes = nodes_.size();
+        stats.depth = depth_;
+        stats.leaf_size = leaf_size_;
+        stats.memory_bytes = nodes_.size() * sizeof(BallNode) + centers_.size() * sizeof(double) +
+                             perm_.size() * sizeof(uint32_t) +
+                             n_points_ * n_features_ * sizeof(double);
+        return stats;
+    }
+
+    int find_k_nearest(const double* query, int k, const double* weights, NeighborSet& scratch,
+                       size_t* out_indices, double* out_distances = nullptr) const override {
+        if (k <= 0 || n_points_ == 0) return 0;
+        if (k <= SMALL_K) {
+            FixedNeighborSet<SMALL_K> neighbors;
+            neighbors.reset(k);
+            dispatch(query, neighbors, weights);
+            return neighbors.extract(out_indices, out_distances);
+        }
+        scratch.reset(k);
+        dispatch(query, scratch, weights);
+        return scratch.extract(out_indices, out_distances);
+    }
+
+private:
+    // 下界平方后乘以该系数，抵消平方和距离内核的相对舍入，避免误剪掉恰好在边界上的等距点
+    static constexpr double BOUND_SLACK = 1.0 - 1e-9;
+
+    const Dataset* dataset_;
+    int n_features_;
+    size_t n_points_;
+    int leaf_size_;
+    int depth_;
+    std::vector<double> build_weights_;
+    std::vector<BallNode> nodes_;
+    std::vector<double> centers_;       // 每个节点一行中心坐标
+    std::vector<uint32_t> perm_;        // 桶内位置 -> 原始样本下标
+    double* columns_;                   // 按 perm_ 重排后的列主序坐标（步长 n_points_）
+
+    double build_distance(const double* a, const double* b) const {
+        return MathUtils::weighted_squared_distance(a, b, n_features_, build_weights_.data());
+    }
+
+    // 建立覆盖 perm_[begin, end) 的子树，返回节点下标
+    int32_t build(size_t begin, size_t end, int depth, std::vector<double>& projection) {
+        int32_t id = (int32_t)nodes_.size();
+        nodes_.push_back(BallNode());
+        centers_.resize(nodes_.size() * n_features_);
+        depth_ = std::max(depth_, depth);
+
+        double* center = centers_.data() + (size_t)id * n_features_;
+        std::fill(center, center + n_features_, 0.0);
+        for (size_t i = begin; i < end; i++) {
+            const double* row = DatasetStorage::row(dataset_, perm_[i]);
+            for (int d = 0; d < n_features_; d++) center[d] += row[d];
+        }
+        for (int d = 0; d < n_features_; d++) center[d] /= (double)(end - begin);
+
+        // 离中心最远的点 a，再取离 a 最远的点 b；相等时取下标较小者，保证建树结果确定
+        double radius2 = -1.0;
+        uint32_t a = perm_[begin];
+        for (size_t i = begin; i < end; i++) {
+            double dist = build_distance(center, DatasetStorage::row(dataset_, perm_[i]));
+            if (dist > radius2 || (dist == radius2 && perm_[i] < a)) {
+                radius2 = dist;
+                a = perm_[i];
+            }
+        }
+
+        BallNode node;
+        node.radius = sqrt(radius2);
+        node.begin = (uint32_t)begin;
+        node.end = (uint32_t)end;
+        node.left = node.right = -1;
+        if (end - begin <= (size_t)leaf_size_) {
+            nodes_[id] = node;
+            return id;
+        }
+
+        const double* pa = DatasetStorage::row(dataset_, a);
+        double far = -1.0;
+        uint32_t b = a;
+        for (size_t i = begin; i < end; i++) {
+            double dist = build_distance(pa, DatasetStorage::row(dataset_, perm_[i]));
+            if (dist > far || (dist == far && perm_[i] < b)) {
+                far = dist;
+                b = perm_[i];
+            }
+        }
+
+        // 投影到 a→b 方向（按构建权重），按投影值的中位数分割
+        const double* pb = DatasetStorage::row(dataset_, b);
+        for (size_t i = begin; i < end; i++) {
+            const double* row = DatasetStorage::row(dataset_, perm_[i]);
+            double p = 0.0;
+            for (int d = 0; d < n_features_; d++) {
+                p += build_weights_[d] * (row[d] - pa[d]) * (pb[d] - pa[d]);
+            }
+            projection[perm_[i]] = p;
+        }
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(perm_.begin() + begin, perm_.begin() + mid, perm_.begin() + end,
+            [&projection](uint32_t x, uint32_t y) {
+                return projection[x] < projection[y] ||
+                       (projection[x] == projection[y] && x < y);
+            });
+
+        node.left = build(begin, mid, depth + 1, projection);
+        node.right = build(mid, end, depth + 1, projection);
+        nodes_[id] = node;
+        return id;
+    }
+
+    template <class Neighbors>
+    void dispatch(const double* query, Neighbors& neighbors, const double* weights) const {
+        // 查询权重与构建权重之比的最大值决定半径的放大倍数
+        double ratio = 0.0;
+        for (int d = 0; d < n_features_; d++) {
+            double w = weights ? weights[d] : 1.0;
+            if (w <= 0.0) continue;
+            ratio = std::max(ratio, build_weights_[d] > 0.0 ? w / build_weights_[d] : INFINITY);
+        }
+        double radius_scale = sqrt(ratio);
+
+        if (n_features_ == FEATURE_COUNT) {
+            if (weights) {
+                search<FEATURE_COUNT, METRIC_WEIGHTED>(query, neighbors, weights, radius_scale);
+            } else {
+                search<FEATURE_COUNT, METRIC_EUCLIDEAN>(query, neighbors, weights, radius_scale);
+            }
+            return;
+        }
+        if (weights) {
+            search<0, METRIC_WEIGHTED>(query, neighbors, weights, radius_scale);
+        } else {
+            search<0, METRIC_EUCLIDEAN>(query, neighbors, weights, radius_scale);
+        }
+    }
+
+    // 查询点到节点内任意点的平方距离下界
+    double lower_bound(int32_t node, const double* query, const double* weights,
+                       double radius_scale) const {
+        const double* center = centers_.data() + (size_t)node * n_features_;
+        double center_dist = sqrt(weights ?
+            MathUtils::weighted_squared_distance(query, center, n_features_, weights) :
+            MathUtils::squared_distance(query, center, n_features_));
+        double radius = nodes_[node].radius;
+        double scaled_radius = radius > 0.0 ? radius * radius_scale : 0.0;
+        // 中心距离、半径和缩放的舍入误差与 center_dist + 缩放后半径成正比，
+        // 先在开方后的量上扣除绝对余量，平方后的相对误差再由 BOUND_SLACK 吸收
+        double margin = (n_features_ + 8) * DBL_EPSILON * (center_dist + scaled_radius);
+        double gap = center_dist - scaled_radius - margin;
+        return gap > 0.0 ? gap * gap * BOUND_SLACK : 0.0;
+    }
+
+    // 显式栈深度优先搜索，先访问下界较小的子节点
+    template <int DIM, int METRIC, class Neighbors>
+    void search(const double* query, Neighbors& neighbors, const double* weights,
+                double radius_scale) const {
+        BlockDistanceKernel kernel = MathUtils::block_kernel<DIM, METRIC>();
+        struct StackEntry {
+            int32_t node;
+            double bound;
+        };
+        StackEntry stack[MAX_DEPTH + 2];
+        int top = 0;
+        stack[top++] = {0, lower_bound(0, query, weights, radius_scale)};
+        double dist[MAX_LEAF_SIZE];
+
+        while (top > 0) {
+            StackEntry entry = stack[--top];
+            // 下界与第 k 近距离相等时仍需访问，其中可能有下标更小的等距点
+            if (entry.bound > neighbors.bound()) {
+                continue;
+            }
+
+            const BallNode& node = nodes_[entry.node];
+            if (node.left >= 0) {
+                double left = lower_bound(node.left, query, weights, radius_scale);
+                double right = lower_bound(node.right, query, weights, radius_scale);
+                if (left <= right) {
+                    stack[top++] = {node.right, right};
+                    stack[top++] = {node.left, left};
+                } else {
+                    stack[top++] = {node.left, left};
+                    stack[top++] = {node.right, right};
+                }
+                continue;
+            }
+
+            size_t count = node.end - node.begin;
+            kernel(query, columns_ + node.begin, n_points_, count, n_features_, weights, dist);
+            for (size_t i = 0; i < count; i++) {
+                size_t index = perm_[node.begin + i];
+                if (neighbors.accepts(dist[i], index)) {
+                    neighbors.push(dist[i], index);
+                }
+            }
+        }
+    }
+};
+
+#endif // BALL_TREE_H
@@ -0,0 +1,217 @@
+#ifndef BRUTE_FORCE_H
+#define BRUTE_FORCE_H
+
+#include <vector>
+#include <algorithm>
+#include "kdtree.h"
+#include "compact_columns.h"
+
+// 暴力 kNN 引擎。训练点按列主序存放；批量查询时把 查询 × 训练点 切成小块，
+// 训练点块留在 L1 中被整块查询复用，每个距离都用与单条查询相同的 SIMD 内核直接计算，
+// 结果与单条查询和 KD 树逐位相同。训练集很小或维度较高时，KD 树几乎无法剪枝，这种方式更快。
+// 低精度模式下先扫描 float32/int16/int8 坐标求距离下界，只对下界不超过当前第 k 近距离的点
+// 用 double 坐标重算（与单条查询同一内核），结果与 KD 树和精确的单条查询完全相同。
+class BruteForceKNN : public SpatialIndex {
+public:
+    static constexpr size_t QUERY_TILE = 32;
+    static constexpr size_t POINT_TILE = 256;
+    static constexpr size_t FILTER_GROUP = 16;
+
+    explicit BruteForceKNN(const Dataset* dataset, StoragePrecision precision = PRECISION_DOUBLE)
+        : dataset_(dataset), n_features_(dataset ? dataset->n_features : 0),
+          n_points_(dataset ? dataset->n_samples : 0), columns_(nullptr) {
+        if (n_points_ == 0) return;
+        columns_ = DatasetStorage::alloc_aligned(n_points_ * n_features_);
+        for (size_t i = 0; i < n_points_; i++) {
+            const double* row = DatasetStorage::row(dataset_, i);
+            for (int d = 0; d < n_features_; d++) {
+                columns_[(size_t)d * n_points_ + i] = row[d];
+            }
+        }
+        compact_.build(columns_, n_points_, n_features_, precision);
+    }
+
+    ~BruteForceKNN() {
+        DatasetStorage::free_aligned(columns_);
+    }
+
+    BruteForceKNN(const BruteForceKNN&) = delete;
+    BruteForceKNN& operator=(const BruteForceKNN&) = delete;
+
+    const char* name() const override { return "brute-force"; }
+    size_t size() const override { return n_points_; }
+    int n_features() const override { return n_features_; }
+
+    IndexStats stats() const override {
+        IndexStats stats;
+        stats.points = n_points_;
+        stats.nodes = 0;
+        stats.depth = 0;
+        stats.leaf_size = 0;
+        stats.memory_bytes = n_points_ * n_features_ * sizeof(double) + compact_.memory_bytes();
+        return stats;
+    }
+
+    StoragePrecision precision() const { return compact_.precision(); }
+
+    // 批量查询的复用缓冲；每个线程一份，容量够用后不再分配
+    struct Scratch {
+        NeighborSet neighbors[QUERY_TILE];
+        CompactQuery compact[QUERY_TILE];
+    };
+
+    // 单个查询：分块调用 SIMD 内核直接计算平方距离。输出约定与 KDTree::find_k_nearest 相同
+    int find_k_nearest(const double* query, int k, const double* weights, NeighborSet& scratch,
+                       size_t* out_indices, double* out_distances = nullptr) const override {
+        scratch.reset(k);
+        if (k <= 0 || n_points_ == 0) return 0;
+
+        if (compact_.enabled()) {
+            static thread_local CompactQuery compact;
+            compact_.prepare(query, weights, compact);
+            for (size_t begin = 0; begin < n_points_; begin += POINT_TILE) {
+                select_compact(query, weights, compact, begin,
+                               std::min(POINT_TILE, n_points_ - begin), scratch);
+            }
+            return scratch.extract(out_indices, out_distances);
+        }
+
+        BlockDistanceKernel kernel = select_kernel(weights);
+        double dist[POINT_TILE];
+        for (size_t begin = 0; begin < n_points_; begin += POINT_TILE) {
+            size_t count = std::min(POINT_TILE, n_points_ - begin);
+            kernel(query, columns_ + begin, n_points_, count, n_features_, weights, dist);
+            select_top_k(dist, begin, count, scratch);
+        }
+        return scratch.extract(out_indices, out_distances);
+    }
+
+    std::vector<size_t> find_k_nearest(const double* query, int k, const double* weights) const {
+        NeighborSet scratch;
+        std::vector<size_t> result(k > 0 ? k : 0);
+        result.resize(find_k_nearest(query, k, weights, scratch, result.data()));
+        return result;
+    }
+
+    // 批量查询，使用当前线程自己的缓冲
+    void find_k_nearest_batch(const double* queries, size_t n_queries, int k,
+                              const double* weights, NeighborMatrix& out,
+                              size_t first_row) const override {
+        static thread_local Scratch scratch;
+        find_k_nearest_batch(queries, n_queries, k, weights, scratch, out, first_row);
+    }
+
+    // 批量查询：queries 为行主序的 n_queries × n_features 矩阵，
+    // 第 i 个查询的结果写入 out 的第 first_row + i 行（out 需已 resize 到足够行数）
+    void find_k_nearest_batch(const double* queries, size_t n_queries, int k,
+                              const double* weights, Scratch& scratch,
+                              NeighborMatrix& out, size_t first_row) const {
+        if (n_queries == 0) return;
+        if (k <= 0 || n_points_ == 0) {
+            for (size_t q = 0; q < n_queries; q++) out.set_count(first_row + q, 0);
+            return;
+        }
+        if (compact_.enabled()) {
+            find_k_nearest_batch_compact(queries, n_queries, k, weights, scratch, out, first_row);
+            return;
+        }
+
+        NeighborSet* neighbors = scratch.neighbors;
+        BlockDistanceKernel kernel = select_kernel(weights);
+        double dist[POINT_TILE];
+        for (size_t q0 = 0; q0 < n_queries; q0 += QUERY_TILE) {
+            size_t nq = std::min(QUERY_TILE, n_queries - q0);
+            for (size_t q = 0; q < nq; q++) {
+                neighbors[q].reset(k);
+            }
+            for (size_t p0 = 0; p0 < n_points_; p0 += POINT_TILE) {
+                size_t np = std::min(POINT_TILE, n_points_ - p0);
+                for (size_t q = 0; q < nq; q++) {
+                    kernel(queries + (q0 + q) * n_features_, columns_ + p0, n_points_, np,
+                           n_features_, weights, dist);
+                    select_top_k(dist, p0, np, neighbors[q]);
+                }
+            }
+            for (size_t q = 0; q < nq; q++) {
+                out.store(first_row + q0 + q, neighbors[q]);
+            }
+        }
+    }
+
+private:
+    const Dataset* dataset_;
+    int n_features_;
+    size_t n_points_;
+    double* columns_;       // 列主序训练点（步长 n_points_）
+    CompactColumns compact_;
+
+    // 低精度模式的批量查询：每个训练点块留在缓存中，依次给块内的每个查询筛选
+    void find_k_nearest_batch_compact(const double* queries, size_t n_queries, int k,
+                                      const double* weights, Scratch& scratch,
+                                      NeighborMatrix& out, size_t first_row) const {
+        for (size_t q0 = 0; q0 < n_queries; q0 += QUERY_TILE) {
+            size_t nq = std::min(QUERY_TILE, n_queries - q0);
+            for (size_t q = 0; q < nq; q++) {
+                scratch.neighbors[q].reset(k);
+                compact_.prepare(queries + (q0 + q) * n_features_, weights, scratch.compact[q]);
+            }
+            for (size_t p0 = 0; p0 < n_points_; p0 += POINT_TILE) {
+                size_t np = std::min(POINT_TILE, n_points_ - p0);
+                for (size_t q = 0; q < nq; q++) {
+                    select_compact(queries + (q0 + q) * n_features_, weights, scratch.compact[q],
+                                   p0, np, scratch.neighbors[q]);
+                }
+            }
+            for (size_t q = 0; q < nq; q++) {
+                out.store(first_row + q0 + q, scratch.neighbors[q]);
+            }
+        }
+    }
+
+    // 一块训练点：先求低精度下界，只对可能进入结果的点用 double 重算距离。
+    // 下界等于第 k 近距离时仍要重算，其中可能有下标更小的等距点
+    void select_compact(const double* query, const double* weights, const CompactQuery& compact,
+                        size_t begin, size_t count, NeighborSet& neighbors) const {
+        float bounds[POINT_TILE];
+        compact_.lower_bounds(compact, begin, count, bounds);
+        float limit = compact_.float_limit(neighbors.bound());
+        for (size_t j0 = 0; j0 < count; j0 += FILTER_GROUP) {
+            size_t j1 = std::min(count, j0 + FILTER_GROUP);
+            // 先整组判断，大部分组没有任何候选，不进入逐点循环
+            bool any = false;
+            for (size_t j = j0; j < j1; j++) any |= bounds[j] <= limit;
+            if (!any) continue;
+            for (size_t j = j0; j < j1; j++) {
+                if (bounds[j] > limit) continue;
+                double dist;
+                MathUtils::squared_distances_block(query, columns_ + begin + j, n_points_, 1,
+                                                   n_features_, weights, &dist);
+                if (neighbors.accepts(dist, begin + j)) {
+                    neighbors.push(dist, begin + j);
+                    limit = compact_.float_limit(neighbors.bound());
+                }
+            }
+        }
+    }
+
+    // 特征数为 FEATURE_COUNT 时用维度展开的内核，结果与通用内核逐位相同
+    BlockDistanceKernel select_kernel(const double* weights) const {
+        if (n_features_ == FEATURE_COUNT) {
+            return weights ? MathUtils::block_kernel<FEATURE_COUNT, METRIC_WEIGHTED>() :
+                             MathUtils::block_kernel<FEATURE_COUNT, METRIC_EUCLIDEAN>();
+        }
+        return weights ? MathUtils::block_kernel<0, METRIC_WEIGHTED>() :
+                         MathUtils::block_kernel<0, METRIC_EUCLIDEAN>();
+    }
+
+    static void select_top_k(const double* dist, size_t offset, size_t count,
+                             NeighborSet& neighbors) {
+        for (size_t j = 0; j < count; j++) {
+            if (neighbors.accepts(dist[j], offset + j)) {
+                neighbors.push(dist[j], offset + j);
+            }
+        }
+    }
+};
+
+#endif // BRUTE_FORCE_H
@@ -0,0 +1,209 @@
+#ifndef COMPACT_COLUMNS_H
+#define COMPACT_COLUMNS_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "../utils/math.h"
+
+// 坐标的存储精度
+enum StoragePrecision {
+    PRECISION_DOUBLE,       // 只有原始的 double 列
+    PRECISION_FLOAT32,
+    PRECISION_INT16,        // 每维线性量化：x ≈ offset + scale · code
+    PRECISION_INT8
+};
+
+// 一个查询在低精度坐标空间中的表示，每维：查询坐标、权重 × scale²、误差余量
+struct CompactQuery {
+    std::vector<float> query;
+    std::vector<float> weight;
+    std::vector<float> slack;
+};
+
+// 低精度的列主序坐标副本，用来快速算出加权平方距离的下界。
+// float32 每个坐标 4 字节，int16/int8 为 2/1 字节，扫描的内存流量是 double 的 1/2 到 1/8，
+// 且下界在 float 中计算，每条向量指令处理的点数加倍。
+//
+// 下界的构造：在量化单位（code 空间）里每维减去误差余量 slack 再平方加权，
+//   LB = Σ w·scale²·max(0, |q_code - code| - slack)²
+// slack 包含该维所有点的量化误差（建立时逐点求出的最大值）、查询坐标转成 float 的误差，
+// 以及 float 减法的舍入余量；平方求和的相对舍入误差再由最后乘的系数吸收。
+// 因此 LB 不超过用 double 列算出的真实距离，用它排除的点一定不在结果中，
+// 其余候选用 double 重新计算后选取，结果与全 double 路径完全相同。
+class CompactColumns {
+public:
+    CompactColumns() : precision_(PRECISION_DOUBLE), n_points_(0), dim_(0) {}
+
+    // 由列主序 double 坐标（步长 n_points）建立；PRECISION_DOUBLE 时清空
+    void build(const double* columns, size_t n_points, int dim, StoragePrecision precision) {
+        precision_ = precision;
+        n_points_ = n_points;
+        dim_ = dim;
+        float32_.clear();
+        int16_.clear();
+        int8_.clear();
+        offset_.assign(dim, 0.0);
+        scale_.assign(dim, 1.0);
+        code_error_.assign(dim, 0.0);
+        code_magnitude_.assign(dim, 0.0);
+        if (precision == PRECISION_DOUBLE || n_points == 0) return;
+
+        if (precision == PRECISION_FLOAT32) float32_.resize(n_points * dim);
+        if (precision == PRECISION_INT16) int16_.resize(n_points * dim);
+        if (precision == PRECISION_INT8) int8_.resize(n_points * dim);
+        for (int d = 0; d < dim; d++) {
+            const double* col = columns + (size_t)d * n_points;
+            switch (precision) {
+                case PRECISION_FLOAT32: encode_float(d, col); break;
+                case PRECISION_INT16: encode_int<int16_t>(d, col, int16_.data()); break;
+                case PRECISION_INT8: encode_int<int8_t>(d, col, int8_.data()); break;
+                default: break;
+            }
+        }
+    }
+
+    bool enabled() const { return precision_ != PRECISION_DOUBLE && n_points_ > 0; }
+    StoragePrecision precision() const { return precision_; }
+
+    size_t memory_bytes() const {
+        return float32_.size() * sizeof(float) + int16_.size() * sizeof(int16_t) +
+               int8_.size() * sizeof(int8_t);
+    }
+
+    static const char* precision_name(StoragePrecision precision) {
+        switch (precision) {
+            case PRECISION_FLOAT32: return "float32";
+            case PRECISION_INT16: return "int16";
+            case PRECISION_INT8: return "int8";
+            default: return "double";
+        }
+    }
+
+    // 把查询换算到 code 空间并算出每维的误差余量；weights 为空表示不加权
+    void prepare(const double* query, const double* weights, CompactQuery& out) const {
+        out.query.resize(dim_);
+        out.weight.resize(dim_);
+        out.slack.resize(dim_);
+        for (int d = 0; d < dim_; d++) {
+            double code = (query[d] - offset_[d]) / scale_[d];
+            float rounded = (float)code;
+            double w = (weights ? weights[d] : 1.0) * scale_[d] * scale_[d];
+            out.query[d] = rounded;
+            out.weight[d] = (float)w;
+            // float 减法 |q - code| 的舍入不超过两者量级之和的 2^-24，这里放宽到 2^-21；
+            // 转成 float 时向上取整，余量只会变大
+            double slack = code_error_[d] + std::fabs(code - rounded) +
+                           (std::fabs(code) + code_magnitude_[d]) * 0x1p-21;
+            out.slack[d] = std::nextafter((float)slack, INFINITY);
+        }
+    }
+
+    // 查询到第 [begin, begin + n) 个点的距离下界
+    void lower_bounds(const CompactQuery& query, size_t begin, size_t n, float* out) const {
+        switch (precision_) {
+            case PRECISION_FLOAT32: dispatch(float32_.data() + begin, n, query, out); break;
+            case PRECISION_INT16: dispatch(int16_.data() + begin, n, query, out); break;
+            case PRECISION_INT8: dispatch(int8_.data() + begin, n, query, out); break;
+            default: std::fill(out, out + n, 0.0f); break;
+        }
+    }
+
+    // 与第 k 近距离 bound 比较用的 float 阈值：下界大于它的点一定比 bound 远。
+    // 除以的系数吸收 float 中平方、加权和求和的相对舍入，转成 float 时向上取整
+    float float_limit(double bound) const {
+        double limit = bound / (1.0 - (dim_ + 4) * 0x1p-22);
+        float rounded = (float)limit;
+        return (double)rounded < limit ? std::nextafter(rounded, INFINITY) : rounded;
+    }
+
+private:
+    StoragePrecision precision_;
+    size_t n_points_;
+    int dim_;
+    std::vector<float> float32_;
+    std::vector<int16_t> int16_;
+    std::vector<int8_t> int8_;
+    std::vector<double> offset_;
+    std::vector<double> scale_;
+    std::vector<double> code_error_;        // 每维 |x 的 code 空间坐标 - 存储的 code| 的最大值
+    std::vector<double> code_magnitude_;    // 每维 |code| 的最大值
+
+    void encode_float(int d, const double* col) {
+        float* codes = float32_.data() + (size_t)d * n_points_;
+        for (size_t j = 0; j < n_points_; j++) {
+            codes[j] = (float)col[j];
+            code_error_[d] = std::max(code_error_[d], std::fabs(col[j] - (double)codes[j]));
+            code_magnitude_[d] = std::max(code_magnitude_[d], std::fabs((double)codes[j]));
+        }
+    }
+
+    // 把 [min, max] 均匀映射到整型的全部取值
+    template <typename T>
+    void encode_int(int d, const double* col, T* storage) {
+        const double lowest = std::numeric_limits<T>::min();
+        const double highest = std::numeric_limits<T>::max();
+        double low = *std::min_element(col, col + n_points_);
+        double high = *std::max_element(col, col + n_points_);
+        double scale = high > low ? (high - low) / (highest - lowest) : 1.0;
+        offset_[d] = low - lowest * scale;
+        scale_[d] = scale;
+
+        T* codes = storage + (size_t)d * n_points_;
+        for (size_t j = 0; j < n_points_; j++) {
+            double code = (col[j] - offset_[d]) / scale;
+            codes[j] = (T)std::min(highest, std::max(lowest, std::nearbyint(code)));
+            code_error_[d] = std::max(code_error_[d], std::fabs(code - codes[j]));
+            code_magnitude_[d] = std::max(code_magnitude_[d], std::fabs((double)codes[j]));
+        }
+    }
+
+    template <typename T>
+    void dispatch(const T* codes, size_t n, const CompactQuery& query, float* out) const {
+#ifdef KNN_X86_SIMD
+        if (MathUtils::simd_level() >= SIMD_AVX2) {
+            lower_bounds_avx2(codes, n_points_, n, dim_, query, out);
+            return;
+        }
+#endif
+        lower_bounds_generic(codes, n_points_, n, dim_, query, out);
+    }
+
+    // 维度在外层、点在内层，内层循环是连续的 float 运算，编译器按当前指令集向量化
+    template <typename T>
+    static inline __attribute__((always_inline))
+    void lower_bounds_body(const T* codes, size_t stride, size_t n, int dim,
+                           const CompactQuery& query, float* out) {
+        std::fill(out, out + n, 0.0f);
+        for (int d = 0; d < dim; d++) {
+            const T* col = codes + (size_t)d * stride;
+            float q = query.query[d];
+            float w = query.weight[d];
+            float slack = query.slack[d];
+            for (size_t j = 0; j < n; j++) {
+                float gap = std::max(0.0f, std::fabs(q - (float)col[j]) - slack);
+                out[j] += w * gap * gap;
+            }
+        }
+    }
+
+    template <typename T>
+    __attribute__((optimize("tree-vectorize")))
+    static void lower_bounds_generic(const T* codes, size_t stride, size_t n, int dim,
+                                     const CompactQuery& query, float* out) {
+        lower_bounds_body(codes, stride, n, dim, query, out);
+    }
+
+#ifdef KNN_X86_SIMD
+    template <typename T>
+    __attribute__((target("avx2"), optimize("tree-vectorize")))
+    static void lower_bounds_avx2(const T* codes, size_t stride, size_t n, int dim,
+                                  const CompactQuery& query, float* out) {
+        lower_bounds_body(codes, stride, n, dim, query, out);
+    }
+#endif
+};
+
+#endif // COMPACT_COLUMNS_H
@@ -0,0 +1,256 @@
+#ifndef DUAL_TREE_H
+#define DUAL_TREE_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "kdtree.h"
+
+// 双树批量查询的统计
+struct DualTreeStats {
+    unsigned long long distance_evaluations;    // 点对距离计算次数
+    unsigned long long node_pairs;              // 计算过包围盒距离的 (查询节点, 训练节点) 对数
+    unsigned long long pruned_pairs;            // 整对剪掉的节点对数
+};
+
+// 双树 kNN：对一批查询也建一棵 KD 树，与训练树一起遍历。
+// 查询树的每个叶子是一组相邻的查询，维护组内第 k 近距离的最大值 B(Q)，
+// 按两个包围盒之间的最小距离由近到远展开训练树，超过 B(Q) 的训练子树对整组查询一次剪掉；
+// 组内每个查询再用自己的第 k 近距离与训练叶子的包围盒比较，跳过不可能更新的叶子。
+// 最近的训练叶子最先扫描，各查询的界比单树深度优先搜索收紧得快，距离计算次数明显减少。
+//
+// 包围盒最小距离与距离内核按同样的顺序逐维累加 (w·g)·g，舍入后仍是下界，
+// 剪枝用严格大于，结果与逐条调用 KDTree::find_k_nearest（未预缩放）完全相同。
+// 对象建立后只读，多个线程可以同时对不同批次调用。
+class DualTreeKNN {
+public:
+    explicit DualTreeKNN(const KDTree* reference)
+        : reference_(reference), n_features_(reference->n_features_) {
+        compute_boxes(*reference_, reference_lo_, reference_hi_);
+    }
+
+    // queries 为行主序的 n_queries × n_features 矩阵，第 i 个查询的结果写入 out 的
+    // 第 first_row + i 行（out 需已 resize 到足够行数，行内按 (距离, 下标) 升序）
+    void find_k_nearest_batch(const double* queries, size_t n_queries, int k,
+                              const double* weights, NeighborMatrix& out, size_t first_row,
+                              DualTreeStats* stats = nullptr) const {
+        if (stats) *stats = DualTreeStats();
+        for (size_t q = 0; q < n_queries; q++) out.set_count(first_row + q, 0);
+        if (n_queries == 0 || k <= 0 || reference_->n_points_ == 0) return;
+
+        Dataset query_data;
+        DatasetStorage::attach(&query_data, (int)n_queries, n_features_,
+                               const_cast<double*>(queries), nullptr, nullptr);
+        {
+            KDTree query_tree(&query_data);
+            DualTreeStats result;
+            if (n_features_ == FEATURE_COUNT) {
+                result = weights ?
+                    traverse<FEATURE_COUNT, METRIC_WEIGHTED>(query_tree, queries, k, weights, out, first_row) :
+                    traverse<FEATURE_COUNT, METRIC_EUCLIDEAN>(query_tree, queries, k, weights, out, first_row);
+            } else {
+                result = weights ?
+                    traverse<0, METRIC_WEIGHTED>(query_tree, queries, k, weights, out, first_row) :
+                    traverse<0, METRIC_EUCLIDEAN>(query_tree, queries, k, weights, out, first_row);
+            }
+            if (stats) *stats = result;
+        }
+        DatasetStorage::release(&query_data);
+    }
+
+private:
+    const KDTree* reference_;
+    int n_features_;
+    std::vector<double> reference_lo_;      // 每个节点一行包围盒下界
+    std::vector<double> reference_hi_;
+
+    // 叶子的包围盒直接由列坐标求出，内部节点取子节点的并；空叶子的包围盒为空（lo > hi）
+    static void compute_boxes(const KDTree& tree, std::vector<double>& lo,
+                              std::vector<double>& hi) {
+        int d = tree.n_features_;
+        size_t n_nodes = tree.n_nodes_;
+        lo.assign(n_nodes * d, INFINITY);
+        hi.assign(n_nodes * d, -INFINITY);
+        size_t first_leaf = ((size_t)1 << tree.levels_) - 1;
+        for (size_t node = first_leaf; node < n_nodes; node++) {
+            const KDFlatNode& leaf = tree.nodes_[node];
+            for (int f = 0; f < d; f++) {
+                const double* col = tree.columns_ + (size_t)f * tree.n_points_;
+                double low = INFINITY, high = -INFINITY;
+                for (uint32_t i = leaf.begin; i < leaf.end; i++) {
+                    low = std::min(low, col[i]);
+                    high = std::max(high, col[i]);
+                }
+                lo[node * d + f] = low;
+                hi[node * d + f] = high;
+            }
+        }
+        for (size_t node = first_leaf; node-- > 0;) {
+            for (int f = 0; f < d; f++) {
+                lo[node * d + f] = std::min(lo[(2 * node + 1) * d + f], lo[(2 * node + 2) * d + f]);
+                hi[node * d + f] = std::max(hi[(2 * node + 1) * d + f], hi[(2 * node + 2) * d + f]);
+            }
+        }
+    }
+
+    template <int DIM, int METRIC>
+    DualTreeStats traverse(const KDTree& query_tree, const double* queries, int k,
+                           const double* weights, NeighborMatrix& out, size_t first_row) const {
+        Traversal<DIM, METRIC> traversal(*this, query_tree, queries, k, weights, out, first_row);
+        traversal.run();
+        return traversal.stats;
+    }
+
+    // 一次批量查询的遍历状态，按维度和度量特化（DIM 为 0 表示运行时维度）
+    template <int DIM, int METRIC>
+    struct Traversal {
+        const DualTreeKNN& owner;
+        const KDTree& query_tree;
+        const KDTree& reference;
+        const double* queries;
+        int k;
+        int d;
+        const double* weights;
+        BlockDistanceKernel kernel;
+        NeighborMatrix& out;
+        size_t first_row;
+        std::vector<double> query_lo;
+        std::vector<double> query_hi;
+        std::vector<std::pair<double, size_t>> frontier;   // 训练节点的小顶堆（按包围盒距离）
+        DualTreeStats stats;
+
+        Traversal(const DualTreeKNN& owner, const KDTree& query_tree, const double* queries,
+                  int k, const double* weights, NeighborMatrix& out, size_t first_row)
+            : owner(owner), query_tree(query_tree), reference(*owner.reference_),
+              queries(queries), k(k), d(DIM > 0 ? DIM : owner.n_features_), weights(weights),
+              kernel(MathUtils::block_kernel<DIM, METRIC>()), out(out), first_row(first_row),
+              stats() {
+            compute_boxes(query_tree, query_lo, query_hi);
+        }
+
+        void run() {
+            size_t first_leaf = ((size_t)1 << query_tree.levels_) - 1;
+            for (size_t leaf = first_leaf; leaf < query_tree.n_nodes_; leaf++) {
+                expand_reference(leaf);
+            }
+        }
+
+        // 一个维度上间隔 gap 对平方距离的贡献，运算顺序与距离内核一致
+        double term(int f, double gap) const {
+            return METRIC == METRIC_WEIGHTED ? weights[f] * gap * gap : gap * gap;
+        }
+
+        double box_distance(size_t query_node, size_t reference_node) const {
+            const double* qlo = query_lo.data() + query_node * d;
+            const double* qhi = query_hi.data() + query_node * d;
+            const double* rlo = owner.reference_lo_.data() + reference_node * d;
+            const double* rhi = owner.reference_hi_.data() + reference_node * d;
+            double sum = 0.0;
+            for (int f = 0; f < d; f++) {
+                sum += term(f, std::max(0.0, std::max(rlo[f] - qhi[f], qlo[f] - rhi[f])));
+            }
+            return sum;
+        }
+
+        double point_box_distance(const double* query, size_t reference_node) const {
+            const double* rlo = owner.reference_lo_.data() + reference_node * d;
+            const double* rhi = owner.reference_hi_.data() + reference_node * d;
+            double sum = 0.0;
+            for (int f = 0; f < d; f++) {
+                sum += term(f, std::max(0.0, std::max(rlo[f] - query[f], query[f] - rhi[f])));
+            }
+            return sum;
+        }
+
+        double row_bound(size_t row) const {
+            int count = out.count(row);
+            return count < k ? INFINITY : out.distances(row)[count - 1];
+        }
+
+        // 把候选并入第 row 行的有序近邻表
+        void offer(size_t row, double dist, size_t index) {
+            int count = out.count(row);
+            size_t* indices = out.indices(row);
+            double* distances = out.distances(row);
+            if (count == k) {
+                NearestNeighbor worst = {distances[k - 1], indices[k - 1]};
+                if (!neighbor_precedes(dist, index, worst)) return;
+            }
+            int pos = count < k ? count++ : k - 1;
+            while (pos > 0) {
+                NearestNeighbor prev = {distances[pos - 1], indices[pos - 1]};
+                if (!neighbor_precedes(dist, index, prev)) break;
+                distances[pos] = distances[pos - 1];
+                indices[pos] = indices[pos - 1];
+                pos--;
+            }
+            distances[pos] = dist;
+            indices[pos] = index;
+            out.set_count(row, count);
+        }
+
+        // 查询叶子对训练叶子：逐个查询扫描，返回组内第 k 近距离的最大值。
+        // pair_distance 为两个包围盒的最小距离，不超过其中任一查询到训练叶子的距离
+        double base_case(size_t query_node, size_t reference_node, double pair_distance) {
+            const KDFlatNode& qleaf = query_tree.nodes_[query_node];
+            const KDFlatNode& rleaf = reference.nodes_[reference_node];
+            size_t count = rleaf.end - rleaf.begin;
+            double dist[KDTree::MAX_LEAF_SIZE];
+            double group_bound = 0.0;
+            for (uint32_t i = qleaf.begin; i < qleaf.end; i++) {
+                size_t q = query_tree.perm_[i];
+                size_t row = first_row + q;
+                const double* query = queries + q * d;
+                double bound = row_bound(row);
+                if (count > 0 && pair_distance <= bound &&
+                    point_box_distance(query, reference_node) <= bound) {
+                    kernel(query, reference.columns_ + rleaf.begin, reference.n_points_, count, d,
+                           weights, dist);
+                    stats.distance_evaluations += count;
+                    for (size_t j = 0; j < count; j++) {
+                        if (dist[j] <= bound) {
+                            offer(row, dist[j], reference.perm_[rleaf.begin + j]);
+                            bound = row_bound(row);
+                        }
+                    }
+                }
+                group_bound = std::max(group_bound, bound);
+            }
+            return group_bound;
+        }
+
+        // 按包围盒距离由近到远展开训练树；堆顶距离超过 B(Q) 时剩余部分全部剪掉。
+        // 与单树搜索相同，距离等于 B(Q) 时仍需访问，其中可能有下标更小的等距点。
+        void expand_reference(size_t query_node) {
+            if (query_tree.nodes_[query_node].begin == query_tree.nodes_[query_node].end) return;
+            auto farther = [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+                return a.first > b.first || (a.first == b.first && a.second > b.second);
+            };
+            double group_bound = INFINITY;
+            frontier.clear();
+            frontier.push_back(std::make_pair(box_distance(query_node, 0), (size_t)0));
+            stats.node_pairs++;
+            while (!frontier.empty()) {
+                std::pop_heap(frontier.begin(), frontier.end(), farther);
+                std::pair<double, size_t> entry = frontier.back();
+                frontier.pop_back();
+                if (entry.first > group_bound) {
+                    stats.pruned_pairs += 1 + frontier.size();
+                    break;
+                }
+                size_t node = entry.second;
+                if (reference.is_leaf(node)) {
+                    group_bound = base_case(query_node, node, entry.first);
+                    continue;
+                }
+                for (size_t child = 2 * node + 1; child <= 2 * node + 2; child++) {
+                    frontier.push_back(std::make_pair(box_distance(query_node, child), child));
+                    std::push_heap(frontier.begin(), frontier.end(), farther);
+                    stats.node_pairs++;
+                }
+            }
+        }
+    };
+};
+
+#endif // DUAL_TREE_H
@@ -0,0 +1,460 @@
+#ifndef DYNAMIC_INDEX_H
+#define DYNAMIC_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "kdtree.h"
+
+// 按编号索引、只增长的数组。按块分配，块目录大小固定，
+// 已发布的元素读者无需加锁即可访问；扩容（ensure）只能由持锁的写者调用。
+template <class T>
+class IdTable {
+public:
+    static constexpr int CHUNK_BITS = 16;
+    static constexpr size_t CHUNK_SIZE = (size_t)1 << CHUNK_BITS;
+    static constexpr size_t MAX_CHUNKS = (size_t)1 << 16;
+    static constexpr size_t CAPACITY = CHUNK_SIZE * MAX_CHUNKS; // 最多 2^32 个编号
+
+    IdTable() : chunks_(new std::atomic<T*>[MAX_CHUNKS]) {
+        for (size_t c = 0; c < MAX_CHUNKS; c++) {
+            chunks_[c].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~IdTable() {
+        for (size_t c = 0; c < MAX_CHUNKS; c++) {
+            delete[] chunks_[c].load(std::memory_order_relaxed);
+        }
+    }
+
+    IdTable(const IdTable&) = delete;
+    IdTable& operator=(const IdTable&) = delete;
+
+    bool ensure(size_t id) {
+        size_t c = id >> CHUNK_BITS;
+        if (c >= MAX_CHUNKS) return false;
+        if (!chunks_[c].load(std::memory_order_relaxed)) {
+            chunks_[c].store(new T[CHUNK_SIZE](), std::memory_order_release);
+        }
+        return true;
+    }
+
+    T& operator[](size_t id) const {
+        return chunks_[id >> CHUNK_BITS].load(std::memory_order_acquire)[id & (CHUNK_SIZE - 1)];
+    }
+
+private:
+    std::unique_ptr<std::atomic<T*>[]> chunks_;
+};
+
+// 支持在线插入和删除的 kNN 索引（对数森林）。
+//   - 新点先追加到固定容量的插入缓冲，查询时直接扫描；
+//   - 缓冲写满后冻结，由后台线程与不大于它的小段合并，建成新的静态 KD 树段，
+//     段的大小大致按 2 的幂增长，任何时刻只有 O(log n) 个段；
+//   - 删除只打墓碑标记，查询时跳过；墓碑超过已存储点数一半时后台整体压缩。
+// 查询取得当前快照（段列表和缓冲的共享指针）后不再加锁，可与插入、删除和后台合并并发执行。
+// 每个点有一个全局递增的编号，结果按 (距离, 编号) 排序，与段的划分方式无关。
+class DynamicKNNIndex {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 256;
+    static constexpr size_t INVALID_ID = SIZE_MAX;     // 编号用尽时 insert/load 的返回值
+
+    // 每个查询线程一份，容量够用后不再分配
+    struct Scratch {
+        NeighborSet merged;
+        NeighborSet segment;
+        std::vector<size_t> indices;
+        std::vector<double> distances;
+        std::vector<double> buffer_distances;
+    };
+
+    // background_merges 为 false 时合并在触发它的 insert/remove 调用中同步完成
+    explicit DynamicKNNIndex(int n_features, bool background_merges = true,
+                             size_t buffer_size = DEFAULT_BUFFER_SIZE)
+        : n_features_(n_features), buffer_size_(std::max((size_t)1, buffer_size)),
+          background_(background_merges), next_id_(0), stored_(0), dead_stored_(0),
+          compact_requested_(false), merging_(false), stop_(false) {
+        std::shared_ptr<Snapshot> snapshot(new Snapshot());
+        snapshot->active.reset(new InsertBuffer(buffer_size_, n_features_));
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(snapshot));
+        if (background_) {
+            worker_ = std::thread(&DynamicKNNIndex::worker_loop, this);
+        }
+    }
+
+    ~DynamicKNNIndex() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        if (worker_.joinable()) worker_.join();
+    }
+
+    DynamicKNNIndex(const DynamicKNNIndex&) = delete;
+    DynamicKNNIndex& operator=(const DynamicKNNIndex&) = delete;
+
+    // 把整个数据集作为一个段批量加入（按行顺序分配编号），返回第一个编号；
+    // 编号不够分配时不加入任何点，返回 INVALID_ID
+    size_t load(const Dataset* dataset) {
+        size_t n = dataset ? dataset->n_samples : 0;
+        size_t first;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (n > IdTable<int>::CAPACITY - next_id_) {
+                printf("编号已用尽，无法加入 %zu 个点\n", n);
+                return INVALID_ID;
+            }
+            first = next_id_;
+            for (size_t i = 0; i < n; i++) {
+                size_t id;
+                if (!reserve_id_locked(dataset->data[i].survived, &id)) return INVALID_ID;
+            }
+            // 编号一经分配就可能被并发删除，与插入一样立即计入 stored_，
+            // 删除时的 dead_stored_++ 才有对应的存储点
+            stored_ += n;
+        }
+        if (n == 0) return first;
+
+        std::vector<Source> sources(n);
+        for (size_t i = 0; i < n; i++) {
+            sources[i].id = first + i;
+            sources[i].row = DatasetStorage::row(dataset, i);
+        }
+        std::shared_ptr<const Segment> segment = build_segment(sources);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::shared_ptr<Snapshot> next(new Snapshot(*current()));
+        if (segment) add_segment(*next, segment);
+        // 建段时丢弃的点都已打过墓碑并计入 dead_stored_，与合并时一样从两者中扣除
+        size_t dropped = n - (segment ? segment->ids.size() : 0);
+        stored_ -= dropped;
+        dead_stored_ -= dropped;
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(next));
+        return first;
+    }
+
+    // 插入一个点，返回它的编号；编号用尽时返回 INVALID_ID
+    size_t insert(const double* features, int label) {
+        bool merge_now = false;
+        size_t id;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!reserve_id_locked(label, &id)) return INVALID_ID;
+            std::shared_ptr<const Snapshot> snapshot = current();
+            InsertBuffer* active = snapshot->active.get();
+            size_t pos = active->count.load(std::memory_order_relaxed);
+            if (pos == buffer_size_) {
+                freeze_active_locked();
+                merge_now = !background_;
+                active = current()->active.get();
+                pos = 0;
+            }
+            std::copy(features, features + n_features_, active->rows.begin() + pos * n_features_);
+            for (int d = 0; d < n_features_; d++) {
+                active->columns[d * buffer_size_ + pos] = features[d];
+            }
+            active->ids[pos] = id;
+            active->count.store(pos + 1, std::memory_order_release);
+            stored_++;
+        }
+        if (merge_now) run_merges();
+        return id;
+    }
+
+    // 删除编号为 id 的点；编号不存在或已删除时返回 false
+    bool remove(size_t id) {
+        bool merge_now = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (id >= next_id_ || removed_[id].load(std::memory_order_relaxed)) return false;
+            removed_[id].store(1, std::memory_order_relaxed);
+            dead_stored_++;
+            if (!compact_requested_ && dead_stored_ * 2 > stored_) {
+                compact_requested_ = true;
+                merge_now = !background_;
+                work_cv_.notify_one();
+            }
+        }
+        if (merge_now) run_merges();
+        return true;
+    }
+
+    // 把插入缓冲并入静态段，并等待所有待处理的合并完成
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (current()->active->count.load(std::memory_order_relaxed) > 0) {
+            freeze_active_locked();
+        }
+        if (!background_) {
+            lock.unlock();
+            run_merges();
+            return;
+        }
+        idle_cv_.wait(lock, [this] { return !has_work_locked() && !merging_; });
+    }
+
+    // 无分配查询：近邻编号按 (距离, 编号) 升序写入 out_ids，out_distances / out_labels
+    // 非空时写入平方距离和标签；返回写出的个数。
+    int find_k_nearest(const double* query, int k, const double* weights, Scratch& scratch,
+                       size_t* out_ids, double* out_distances = nullptr,
+                       int* out_labels = nullptr) const {
+        NeighborSet& merged = scratch.merged;
+        merged.reset(k);
+        if (k <= 0) return 0;
+        std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&snapshot_);
+
+        scratch.indices.resize(k);
+        scratch.distances.resize(k);
+        for (const auto& segment : snapshot->segments) {
+            TombstoneFilter filter = {segment->ids.data(), &removed_};
+            int count = segment->tree->find_k_nearest_filtered(
+                query, k, weights, scratch.segment, filter,
+                scratch.indices.data(), scratch.distances.data());
+            for (int i = 0; i < count; i++) {
+                size_t id = segment->ids[scratch.indices[i]];
+                if (merged.accepts(scratch.distances[i], id)) {
+                    merged.push(scratch.distances[i], id);
+                }
+            }
+        }
+        scratch.buffer_distances.resize(buffer_size_);
+        for (const auto& buffer : snapshot->frozen) {
+            scan_buffer(*buffer, query, weights, scratch.buffer_distances.data(), merged);
+        }
+        scan_buffer(*snapshot->active, query, weights, scratch.buffer_distances.data(), merged);
+
+        int count = merged.extract(out_ids, out_distances);
+        if (out_labels) {
+            for (int i = 0; i < count; i++) {
+                out_labels[i] = labels_[out_ids[i]];
+            }
+        }
+        return count;
+    }
+
+    // 未删除的点数
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stored_ - dead_stored_;
+    }
+
+    size_t segment_count() const {
+        return std::atomic_load(&snapshot_)->segments.size();
+    }
+
+    int n_features() const { return n_features_; }
+
+private:
+    struct Segment {
+        Dataset data;
+        std::unique_ptr<KDTree> tree;
+        std::vector<size_t> ids;            // 局部下标 -> 全局编号，升序
+
+        Segment() : data() {}
+        ~Segment() {
+            tree.reset();
+            DatasetStorage::release(&data);
+        }
+    };
+
+    // 追加写入的插入缓冲：写者在 count 之后写入，再以 release 语义发布新的 count。
+    // 行主序坐标供合并建段，列主序副本（步长 capacity）供查询时用块内核扫描
+    struct InsertBuffer {
+        InsertBuffer(size_t capacity, int n_features)
+            : rows(capacity * n_features), columns(capacity * n_features), ids(capacity),
+              count(0) {}
+
+        std::vector<double> rows;
+        std::vector<double> columns;
+        std::vector<size_t> ids;
+        std::atomic<size_t> count;
+    };
+
+    // 不可变快照；段按大小升序
+    struct Snapshot {
+        std::vector<std::shared_ptr<const Segment>> segments;
+        std::vector<std::shared_ptr<InsertBuffer>> frozen;     // 已写满、等待合并
+        std::shared_ptr<InsertBuffer> active;
+    };
+
+    struct TombstoneFilter {
+        const size_t* ids;
+        const IdTable<std::atomic<uint8_t>>* removed;
+
+        bool excluded(size_t local) const {
+            return (*removed)[ids[local]].load(std::memory_order_relaxed) != 0;
+        }
+    };
+
+    struct Source {
+        size_t id;
+        const double* row;
+    };
+
+    int n_features_;
+    size_t buffer_size_;
+    bool background_;
+
+    std::shared_ptr<const Snapshot> snapshot_;     // 通过 std::atomic_load/atomic_store 访问
+    IdTable<std::atomic<uint8_t>> removed_;
+    IdTable<int> labels_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::thread worker_;
+    size_t next_id_;
+    size_t stored_;                         // 段和缓冲中实际存放的点数（含已删除）
+    size_t dead_stored_;                    // 其中已删除的点数
+    bool compact_requested_;
+    bool merging_;
+    bool stop_;
+
+    std::shared_ptr<const Snapshot> current() const {
+        return std::atomic_load(&snapshot_);
+    }
+
+    // 分配下一个编号；超出编号表容量时返回 false，不改变 next_id_
+    bool reserve_id_locked(int label, size_t* id) {
+        if (!removed_.ensure(next_id_) || !labels_.ensure(next_id_)) {
+            printf("编号已用尽\n");
+            return false;
+        }
+        *id = next_id_++;
+        labels_[*id] = label;
+        return true;
+    }
+
+    void freeze_active_locked() {
+        std::shared_ptr<Snapshot> next(new Snapshot(*current()));
+        next->frozen.push_back(next->active);
+        next->active.reset(new InsertBuffer(buffer_size_, n_features_));
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(next));
+        work_cv_.notify_one();
+    }
+
+    bool has_work_locked() const {
+        return !current()->frozen.empty() || compact_requested_;
+    }
+
+    static void add_segment(Snapshot& snapshot, const std::shared_ptr<const Segment>& segment) {
+        auto pos = std::upper_bound(
+            snapshot.segments.begin(), snapshot.segments.end(), segment->ids.size(),
+            [](size_t size, const std::shared_ptr<const Segment>& s) { return size < s->ids.size(); });
+        snapshot.segments.insert(pos, segment);
+    }
+
+    // 与段内 KD 树叶子扫描用同一套块内核，点在缓冲中和合并进段后的距离逐位相同
+    void scan_buffer(const InsertBuffer& buffer, const double* query, const double* weights,
+                     double* dist, NeighborSet& merged) const {
+        size_t count = buffer.count.load(std::memory_order_acquire);
+        MathUtils::squared_distances_block(query, buffer.columns.data(), buffer_size_, count,
+                                           n_features_, weights, dist);
+        for (size_t i = 0; i < count; i++) {
+            size_t id = buffer.ids[i];
+            if (removed_[id].load(std::memory_order_relaxed)) continue;
+            if (merged.accepts(dist[i], id)) {
+                merged.push(dist[i], id);
+            }
+        }
+    }
+
+    // 用未删除的源点（任意顺序）建一个新段；全部已删除时返回空指针
+    std::shared_ptr<const Segment> build_segment(std::vector<Source>& sources) const {
+        sources.erase(std::remove_if(sources.begin(), sources.end(), [this](const Source& s) {
+            return removed_[s.id].load(std::memory_order_relaxed) != 0;
+        }), sources.end());
+        if (sources.empty()) return nullptr;
+        std::sort(sources.begin(), sources.end(),
+                  [](const Source& a, const Source& b) { return a.id < b.id; });
+
+        std::shared_ptr<Segment> segment(new Segment());
+        DatasetStorage::allocate(&segment->data, (int)sources.size(), n_features_);
+        segment->ids.resize(sources.size());
+        for (size_t i = 0; i < sources.size(); i++) {
+            std::copy(sources[i].row, sources[i].row + n_features_,
+                      segment->data.matrix + i * n_features_);
+            segment->data.data[i].survived = labels_[sources[i].id];
+            segment->ids[i] = sources[i].id;
+        }
+        segment->tree.reset(new KDTree(&segment->data));
+        return segment;
+    }
+
+    // 执行一次合并：所有冻结缓冲，加上从小到大不超过累计规模的段（压缩时为全部段）
+    bool merge_once() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (merging_ || !has_work_locked()) return false;
+        std::shared_ptr<const Snapshot> snapshot = current();
+        bool compact = compact_requested_;
+        compact_requested_ = false;
+        merging_ = true;
+        lock.unlock();
+
+        std::vector<Source> sources;
+        std::vector<std::shared_ptr<InsertBuffer>> buffers = snapshot->frozen;
+        for (const auto& buffer : buffers) {
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                sources.push_back({buffer->ids[i], buffer->rows.data() + i * n_features_});
+            }
+        }
+        std::vector<std::shared_ptr<const Segment>> inputs;
+        for (const auto& segment : snapshot->segments) {
+            if (!compact && segment->ids.size() > sources.size()) break;
+            for (size_t i = 0; i < segment->ids.size(); i++) {
+                sources.push_back({segment->ids[i], DatasetStorage::row(&segment->data, i)});
+            }
+            inputs.push_back(segment);
+        }
+        size_t input_points = sources.size();
+        std::shared_ptr<const Segment> merged = build_segment(sources);
+
+        lock.lock();
+        std::shared_ptr<Snapshot> next(new Snapshot(*current()));
+        auto consumed_segment = [&inputs](const std::shared_ptr<const Segment>& s) {
+            return std::find(inputs.begin(), inputs.end(), s) != inputs.end();
+        };
+        auto consumed_buffer = [&buffers](const std::shared_ptr<InsertBuffer>& b) {
+            return std::find(buffers.begin(), buffers.end(), b) != buffers.end();
+        };
+        next->segments.erase(std::remove_if(next->segments.begin(), next->segments.end(),
+                                            consumed_segment), next->segments.end());
+        next->frozen.erase(std::remove_if(next->frozen.begin(), next->frozen.end(),
+                                          consumed_buffer), next->frozen.end());
+        if (merged) add_segment(*next, merged);
+        size_t dropped = input_points - (merged ? merged->ids.size() : 0);
+        stored_ -= dropped;
+        dead_stored_ -= dropped;
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(next));
+        merging_ = false;
+        idle_cv_.notify_all();
+        return true;
+    }
+
+    void run_merges() {
+        while (merge_once()) {
+        }
+    }
+
+    void worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            if (has_work_locked()) {
+                lock.unlock();
+                run_merges();
+                lock.lock();
+                continue;
+            }
+            work_cv_.wait(lock);
+        }
+    }
+};
+
+#endif // DYNAMIC_INDEX_H
@@ -0,0 +1,229 @@
+#ifndef GRID_SEARCH_H
+#define GRID_SEARCH_H
+
+#include <stdint.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <mutex>
+#include "kdtree.h"
+#include "../utils/thread_pool.h"
+
+// 一组超参数的交叉验证结果
+struct GridSearchResult {
+    size_t weight_index;    // 在候选权重中的序号
+    int k;
+    double accuracy;        // 所有折的验证集合在一起的准确率
+};
+
+// k 折交叉验证的网格搜索：每折只建一棵 KD 树，所有候选权重共用
+// （权重只在查询时参与距离计算，不影响树的结构）。
+// 每个验证点只按 k_max 查询一次：近邻按 (距离, 下标) 升序排列，前 k 个正是 k 近邻，
+// 对投票做前缀和即可一次得到 1..k_max 每个 k 的预测。
+// 投票规则与 Predictor 相同（平票判为存活）。(候选权重, 验证点) 对按块分给线程池，
+// 计数为整数，结果与线程数无关。
+class GridSearch {
+public:
+    // data 需带标签；n_folds 至少为 2 且不超过样本数。seed 决定样本分到哪一折
+    GridSearch(const Dataset* data, int n_folds, uint64_t seed = 1, int num_threads = 1)
+        : data_(data), n_folds_(n_folds), num_threads_(std::max(1, num_threads)) {
+        if (!data || n_folds < 2 || n_folds > data->n_samples) {
+            printf("交叉验证折数无效: %d\n", n_folds);
+            return;
+        }
+        for (int i = 0; i < data->n_samples; i++) {
+            if (data->data[i].survived < 0) {
+                printf("交叉验证需要带标签的数据集\n");
+                return;
+            }
+        }
+
+        // 打乱后轮流分配，各折大小最多相差 1
+        std::vector<size_t> order(data->n_samples);
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::mt19937_64 rng(seed);
+        std::shuffle(order.begin(), order.end(), rng);
+        std::vector<int> fold_of(order.size());
+        for (size_t i = 0; i < order.size(); i++) fold_of[order[i]] = (int)(i % n_folds);
+
+        folds_.resize(n_folds);
+        for (int f = 0; f < n_folds; f++) {
+            build_fold(f, fold_of);
+            for (size_t i = 0; i < fold_of.size(); i++) {
+                if (fold_of[i] == f) {
+                    validation_.push_back(ValidationPoint{i, f});
+                }
+            }
+        }
+    }
+
+    ~GridSearch() {
+        for (auto& fold : folds_) {
+            delete fold.tree;
+            if (fold.train.arena) DatasetStorage::release(&fold.train);
+        }
+    }
+
+    GridSearch(const GridSearch&) = delete;
+    GridSearch& operator=(const GridSearch&) = delete;
+
+    bool valid() const { return !validation_.empty(); }
+
+    // 评估每组候选权重（每组 n_features 个）在 k = 1..k_max 下的准确率，
+    // 结果按 [权重序号 * k_max + (k - 1)] 排列；参数无效时返回空
+    std::vector<double> evaluate(const std::vector<std::vector<double>>& candidates, int k_max) {
+        if (!valid() || k_max <= 0 || candidates.empty()) return std::vector<double>();
+        for (const auto& weights : candidates) {
+            if ((int)weights.size() != data_->n_features) {
+                printf("候选权重维度不匹配: %zu\n", weights.size());
+                return std::vector<double>();
+            }
+        }
+
+        size_t n = validation_.size();
+        std::vector<long long> correct(candidates.size() * k_max, 0);
+        std::mutex merge_mutex;
+        auto body = [&](size_t begin, size_t end) {
+            Scratch& scratch = thread_scratch();
+            scratch.indices.resize(k_max);
+            scratch.correct.assign(k_max, 0);
+            size_t current = begin / n;
+            for (size_t task = begin; task < end; task++) {
+                size_t w = task / n;
+                if (w != current) {
+                    merge(scratch.correct, current, k_max, correct, merge_mutex);
+                    current = w;
+                }
+                score_point(validation_[task % n], candidates[w].data(), k_max, scratch);
+            }
+            merge(scratch.correct, current, k_max, correct, merge_mutex);
+        };
+        size_t n_tasks = candidates.size() * n;
+        if (num_threads_ > 1) {
+            ThreadPool pool(num_threads_);
+            pool.parallel_for(n_tasks, TASK_CHUNK, body);
+        } else {
+            body(0, n_tasks);
+        }
+
+        std::vector<double> accuracy(correct.size());
+        for (size_t i = 0; i < correct.size(); i++) {
+            accuracy[i] = (double)correct[i] / n;
+        }
+        return accuracy;
+    }
+
+    // evaluate 结果中准确率最高的组合；并列时取较小的 k，再取较前的权重
+    static GridSearchResult best(const std::vector<double>& accuracy, int k_max) {
+        GridSearchResult result = {0, 0, -1.0};
+        if (k_max <= 0) return result;
+        for (int k = 1; k <= k_max; k++) {
+            for (size_t w = 0; w * k_max < accuracy.size(); w++) {
+                double value = accuracy[w * k_max + (k - 1)];
+                if (value > result.accuracy) {
+                    result = GridSearchResult{w, k, value};
+                }
+            }
+        }
+        return result;
+    }
+
+    // 各维候选值的笛卡尔积，最后一维变化最快
+    static std::vector<std::vector<double>> cartesian(
+            const std::vector<std::vector<double>>& values_per_feature) {
+        std::vector<std::vector<double>> grid(1);
+        for (const auto& values : values_per_feature) {
+            std::vector<std::vector<double>> next;
+            next.reserve(grid.size() * values.size());
+            for (const auto& prefix : grid) {
+                for (double value : values) {
+                    next.push_back(prefix);
+                    next.back().push_back(value);
+                }
+            }
+            grid.swap(next);
+        }
+        return grid;
+    }
+
+    int n_folds() const { return n_folds_; }
+    size_t n_validation() const { return validation_.size(); }
+
+private:
+    static constexpr size_t TASK_CHUNK = 64;
+
+    struct Fold {
+        Dataset train;          // 不属于该折的样本（拷贝），标签随样本一起
+        KDTree* tree;
+    };
+
+    struct ValidationPoint {
+        size_t row;             // 在原数据集中的行号
+        int fold;
+    };
+
+    // 每个线程一份，线程池的工作线程在各块之间复用
+    struct Scratch {
+        NeighborSet neighbors;
+        std::vector<size_t> indices;
+        std::vector<long long> correct;
+    };
+
+    const Dataset* data_;
+    int n_folds_;
+    int num_threads_;
+    std::vector<Fold> folds_;
+    std::vector<ValidationPoint> validation_;   // 按折分组，组内按行号升序
+
+    static Scratch& thread_scratch() {
+        static thread_local Scratch scratch;
+        return scratch;
+    }
+
+    void build_fold(int f, const std::vector<int>& fold_of) {
+        Fold& fold = folds_[f];
+        int d = data_->n_features;
+        int n_train = 0;
+        for (int v : fold_of) n_train += v != f;
+        DatasetStorage::allocate(&fold.train, n_train, d);
+        int row = 0;
+        for (size_t i = 0; i < fold_of.size(); i++) {
+            if (fold_of[i] == f) continue;
+            std::copy(DatasetStorage::row(data_, i), DatasetStorage::row(data_, i) + d,
+                      fold.train.matrix + (size_t)row * d);
+            fold.train.data[row].survived = data_->data[i].survived;
+            row++;
+        }
+        fold.tree = new KDTree(&fold.train, KDTree::DEFAULT_LEAF_SIZE, 0, num_threads_);
+    }
+
+    // 查询一次 k_max 近邻，按前缀投票为每个 k 记一次对错
+    void score_point(const ValidationPoint& point, const double* weights, int k_max,
+                     Scratch& scratch) const {
+        const Fold& fold = folds_[point.fold];
+        int count = fold.tree->find_k_nearest(DatasetStorage::row(data_, point.row), k_max, weights,
+                                              scratch.neighbors, scratch.indices.data());
+        int truth = data_->data[point.row].survived;
+        int votes = 0;
+        int prediction = 1;     // 没有近邻时与 Predictor 一致
+        for (int k = 1; k <= k_max; k++) {
+            // 训练点不足 k 个时沿用全部近邻的投票
+            if (k <= count) {
+                votes += fold.train.data[scratch.indices[k - 1]].survived;
+                prediction = 2 * votes >= k;
+            }
+            scratch.correct[k - 1] += prediction == truth;
+        }
+    }
+
+    static void merge(std::vector<long long>& local, size_t w, int k_max,
+                      std::vector<long long>& total, std::mutex& mutex) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 0; k < k_max; k++) {
+            total[w * k_max + k] += local[k];
+            local[k] = 0;
+        }
+    }
+};
+
+#endif // GRID_SEARCH_H
@@ -0,0 +1,101 @@
+#ifndef KDFOREST_H
+#define KDFOREST_H
+
+#include <vector>
+#include "kdtree.h"
+
+// 随机化 KD 树森林：各棵树在散布最大的几维中随机选分割维度，搜索时共用一个候选集合，
+// 近似搜索的叶子/距离预算平均分给各棵树。一棵树漏掉的区域往往落在另一棵树的近处叶子里，
+// 同样的预算下召回率高于单棵树。
+class RandomizedKDForest {
+public:
+    static constexpr int DEFAULT_TREES = 4;
+
+    // 每个查询线程一份；visited 记录本次查询已加入候选的点，避免多棵树重复插入
+    struct Scratch {
+        NeighborSet neighbors;
+        std::vector<uint32_t> visited;
+        uint32_t epoch = 0;
+    };
+
+    RandomizedKDForest(const Dataset* dataset, int n_trees = DEFAULT_TREES, uint64_t seed = 1,
+                       int leaf_size = KDTree::DEFAULT_LEAF_SIZE)
+        : n_points_(dataset ? dataset->n_samples : 0) {
+        if (n_trees < 1) n_trees = 1;
+        if (seed == 0) seed = 1;
+        trees_.reserve(n_trees);
+        for (int t = 0; t < n_trees; t++) {
+            trees_.push_back(new KDTree(dataset, leaf_size, seed + (uint64_t)t * 0x632BE59BD9B4E019ull));
+        }
+    }
+
+    ~RandomizedKDForest() {
+        for (KDTree* tree : trees_) delete tree;
+    }
+
+    RandomizedKDForest(const RandomizedKDForest&) = delete;
+    RandomizedKDForest& operator=(const RandomizedKDForest&) = delete;
+
+    // 接口与 KDTree::find_k_nearest_approx 相同；params 为默认值时结果与单棵树的精确搜索一致
+    int find_k_nearest(const double* query, int k, const double* weights,
+                       const ApproxParams& params, Scratch& scratch,
+                       size_t* out_indices, double* out_distances = nullptr) const {
+        if (k <= 0 || n_points_ == 0) return 0;
+        if (scratch.visited.size() != n_points_) {
+            scratch.visited.assign(n_points_, 0);
+            scratch.epoch = 0;
+        }
+        if (++scratch.epoch == 0) {
+            std::fill(scratch.visited.begin(), scratch.visited.end(), 0);
+            scratch.epoch = 1;
+        }
+        VisitedFilter filter = {scratch.visited.data(), scratch.epoch};
+        KDTree::SearchLimits limits = KDTree::SearchLimits::from(params, trees_.size());
+
+        if (k <= KDTree::SMALL_K) {
+            FixedNeighborSet<KDTree::SMALL_K> neighbors;
+            neighbors.reset(k);
+            for (const KDTree* tree : trees_) {
+                tree->search_into(query, neighbors, weights, filter, limits);
+            }
+            return neighbors.extract(out_indices, out_distances);
+        }
+        scratch.neighbors.reset(k);
+        for (const KDTree* tree : trees_) {
+            tree->search_into(query, scratch.neighbors, weights, filter, limits);
+        }
+        return scratch.neighbors.extract(out_indices, out_distances);
+    }
+
+    // 所有树用同一组权重预缩放，保证各棵树返回的距离可以直接比较
+    bool prescale(const double* weights) {
+        bool ok = true;
+        for (KDTree* tree : trees_) ok = tree->prescale(weights) && ok;
+        if (!ok) {
+            for (KDTree* tree : trees_) tree->clear_prescale();
+        }
+        return ok;
+    }
+
+    int tree_count() const { return (int)trees_.size(); }
+    size_t size() const { return n_points_; }
+
+private:
+    // 只在候选被接受时调用：第一次见到的点记入 visited 并放行，之后的树再遇到则跳过。
+    // 被挤出候选集合的点即使再次出现也不会被接受，所以不必清除标记。
+    struct VisitedFilter {
+        uint32_t* visited;
+        uint32_t epoch;
+
+        bool excluded(size_t index) const {
+            if (visited[index] == epoch) return true;
+            visited[index] = epoch;
+            return false;
+        }
+    };
+
+    std::vector<KDTree*> trees_;
+    size_t n_points_;
+};
+
+#endif // KDFOREST_H
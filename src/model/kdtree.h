@@ -1,144 +1,638 @@
 #ifndef KDTREE_H
 #define KDTREE_H
 
+#include <stdint.h>
 #include <vector>
 #include <algorithm>
 #include <cmath>
 #include "../utils/math.h"
+#include "../utils/mapped_file.h"
+#include "../utils/arena.h"
+#include "../utils/search_stats.h"
+#include "../utils/thread_pool.h"
 #include "../data/loader.h"
+#include "neighbor_set.h"
+#include "spatial_index.h"
 
 // 前向声明
 class KDTree;
+class KDTreeIndexFile;
+class RandomizedKDForest;
+class DualTreeKNN;
 
-struct NearestNeighbor {
-    double distance;
-    const double* point;
-    size_t index;
-    
-    NearestNeighbor() : distance(INFINITY), point(nullptr), index(0) {}
+// 近似搜索参数；全部取默认值时为精确搜索
+struct ApproxParams {
+    double epsilon = 0.0;           // (1+ε) 剪枝：保证返回的第 i 近距离不超过真实值的 (1+ε) 倍
+    size_t max_leaves = 0;          // 每次查询最多访问的叶子数，0 表示不限
+    size_t max_evaluations = 0;     // 每次查询最多计算的距离数，0 表示不限（至少扫描一个叶子）
+
+    bool exact() const {
+        return epsilon <= 0.0 && max_leaves == 0 && max_evaluations == 0;
+    }
+};
+
+// 不排除任何点的过滤器。自定义过滤器提供 excluded(样本下标)，返回 true 的点不参与搜索。
+struct NoFilter {
+    bool excluded(size_t) const { return false; }
 };
 
-struct KDNode {
-    const double* point;
-    size_t index;
+// 扁平节点：按广度优先顺序存放在一个数组里，节点 i 的子节点为 2i+1 和 2i+2
+struct KDFlatNode {
+    double split_value;     // 右子树中所有点在 split_dim 上 >= split_value
     int split_dim;
-    KDNode *left, *right;
-    
-    KDNode(const double* p, size_t idx, int dim) 
-        : point(p), index(idx), split_dim(dim), left(nullptr), right(nullptr) {}
+    uint32_t begin;         // 该节点覆盖的点在 columns_ 中的列范围 [begin, end)
+    uint32_t end;
+    uint32_t reserved;      // 显式写出的对齐填充，恒为 0，索引文件中不含未初始化的字节
 };
 
-class KDTree {
+// 节点数组会原样写入索引文件，布局必须固定
+static_assert(sizeof(KDFlatNode) == 24, "KDFlatNode layout is part of the index file format");
+
+class KDTree : public SpatialIndex {
+public:
+    static constexpr int DEFAULT_LEAF_SIZE = 32;
+    static constexpr int MAX_LEAF_SIZE = 256;
+    static constexpr int MAX_LEVELS = 48;
+    static constexpr int SMALL_K = 16;      // k 不超过该值时候选集合放在栈上
+    static constexpr int MAX_PRESCALED_DIM = 256;
+
+    // 并行建树：点数不少于 PARALLEL_BUILD_MIN 时才启用线程池；
+    // 不短于 PARALLEL_PARTITION_MIN 的区间按 PARTITION_CHUNK 分块划分（串行建树也一样），
+    // 节点数达到线程数的 FORK_TASKS_PER_THREAD 倍后各子树作为独立任务分给线程池
+    static constexpr size_t PARALLEL_BUILD_MIN = 1 << 15;
+    static constexpr size_t PARALLEL_PARTITION_MIN = 1 << 19;
+    static constexpr size_t PARTITION_CHUNK = 1 << 14;
+    static constexpr int FORK_TASKS_PER_THREAD = 4;
+
 private:
+    friend class KDTreeIndexFile;
+    friend class RandomizedKDForest;
+    friend class DualTreeKNN;
+
+    // 搜索循环使用的限制；精确搜索时 prune_scale 为 1，两个预算为最大值
+    struct SearchLimits {
+        double prune_scale;             // 剪枝时下界乘以 (1+ε)^2
+        size_t max_leaves;
+        size_t max_evaluations;
+
+        static SearchLimits from(const ApproxParams& params, size_t n_parts = 1) {
+            SearchLimits limits;
+            double factor = 1.0 + std::max(params.epsilon, 0.0);
+            limits.prune_scale = factor * factor;
+            limits.max_leaves = split_budget(params.max_leaves, n_parts);
+            limits.max_evaluations = split_budget(params.max_evaluations, n_parts);
+            return limits;
+        }
+
+        // 预算平均分给 n_parts 棵树，每棵至少为 1
+        static size_t split_budget(size_t budget, size_t n_parts) {
+            if (budget == 0) return SIZE_MAX;
+            return std::max((size_t)1, (budget + n_parts - 1) / n_parts);
+        }
+    };
+
     const Dataset* dataset_;
-    KDNode* root;
+    int n_features_;
+    size_t n_points_;
+    int leaf_size_;
+    int levels_;                        // 内部节点层数，叶子全部位于第 levels_ 层
+    uint64_t split_seed_;               // 非 0 时随机选择分割维度（随机化森林）
+
+    // 三个数组不含指针，既可以由本对象持有，也可以直接指向映射的索引文件
+    const KDFlatNode* nodes_;
+    size_t n_nodes_;
+    const uint32_t* perm_;              // 桶内位置 -> 原始样本下标
+    const double* columns_;             // 按 perm_ 重排后的列主序坐标（步长 n_points_），叶子桶连续
+
+    // 自建时三个数组都从 arena_ 的同一个块中切出，析构时一次归还
+    Arena arena_;
+    KDFlatNode* node_storage_;
+    uint32_t* perm_storage_;
+    MappedFile* mapping_;               // 从索引文件打开时持有映射
+
+    // 预缩放空间：每一维乘以 sqrt(w)，加权距离变为普通欧氏距离。
+    // 轴向正比例缩放不改变各维的排序，树结构原样复用，只需缩放坐标和分割值。
+    double* scaled_columns_;
+    double* scaled_splits_;             // 按节点下标存放
+    double* scale_;                     // 各维 sqrt(w)
+    double* baked_weights_;             // 当前预缩放所用的权重
+    bool prescaled_;
 
     // 声明所有私有成员函数
-    void free_tree(KDNode* node);
-    KDNode* build_tree(size_t* indices, size_t n_points, int depth);
-    void find_k_nearest_impl(KDNode* node, const double* query, int k, 
-                           NearestNeighbor* neighbors, const double* weights);
+    void build_tree(size_t node, size_t begin, size_t end, int depth, uint32_t* buffer);
+    void build_parallel(uint32_t* buffer, ThreadPool& pool);
+    void split_node(size_t node, size_t begin, size_t end, int depth, uint32_t* buffer,
+                    ThreadPool* pool);
+    void select_median(size_t begin, size_t mid, size_t end, int dim, uint32_t* buffer,
+                       ThreadPool* pool);
+    bool point_less(uint32_t a, uint32_t b, int dim) const {
+        double va = DatasetStorage::row(dataset_, a)[dim];
+        double vb = DatasetStorage::row(dataset_, b)[dim];
+        return va < vb || (va == vb && a < b);
+    }
+    int random_split_dim(size_t node, size_t begin, size_t end) const;
+    // 搜索按维度（0 表示运行时维度）、度量和候选集合类型特化，
+    // search_into 在每次查询开始时分派一次
+    // SCALED 为真时在预缩放空间中搜索（query 已缩放，METRIC 为欧氏距离）
+    template <int DIM, int METRIC, bool SCALED, class Neighbors, class Filter>
+    void scan_leaf(const KDFlatNode& leaf, const double* query, BlockDistanceKernel kernel,
+                   Neighbors& neighbors, const double* weights, const Filter& filter) const;
+    template <int DIM, int METRIC, bool SCALED, class Neighbors, class Filter>
+    void find_k_nearest_impl(const double* query, Neighbors& neighbors, const double* weights,
+                             const Filter& filter, const SearchLimits& limits) const;
+
+    // 把候选点并入 neighbors（可以已含其他树的结果）
+    template <class Neighbors, class Filter>
+    void search_into(const double* query, Neighbors& neighbors, const double* weights,
+                     const Filter& filter, const SearchLimits& limits) const {
+        if (weights && prescaled_for(weights)) {
+            double scaled_query[MAX_PRESCALED_DIM];
+            for (int d = 0; d < n_features_; d++) {
+                scaled_query[d] = query[d] * scale_[d];
+            }
+            if (n_features_ == FEATURE_COUNT) {
+                find_k_nearest_impl<FEATURE_COUNT, METRIC_EUCLIDEAN, true>(
+                    scaled_query, neighbors, nullptr, filter, limits);
+            } else {
+                find_k_nearest_impl<0, METRIC_EUCLIDEAN, true>(
+                    scaled_query, neighbors, nullptr, filter, limits);
+            }
+            return;
+        }
+        if (n_features_ == FEATURE_COUNT) {
+            if (weights) {
+                find_k_nearest_impl<FEATURE_COUNT, METRIC_WEIGHTED, false>(
+                    query, neighbors, weights, filter, limits);
+            } else {
+                find_k_nearest_impl<FEATURE_COUNT, METRIC_EUCLIDEAN, false>(
+                    query, neighbors, weights, filter, limits);
+            }
+            return;
+        }
+        if (weights) {
+            find_k_nearest_impl<0, METRIC_WEIGHTED, false>(query, neighbors, weights, filter, limits);
+        } else {
+            find_k_nearest_impl<0, METRIC_EUCLIDEAN, false>(query, neighbors, weights, filter, limits);
+        }
+    }
+
+    template <class Filter>
+    int search(const double* query, int k, const double* weights, NeighborSet& scratch,
+               const Filter& filter, const SearchLimits& limits,
+               size_t* out_indices, double* out_distances) const {
+        if (k <= 0 || n_points_ == 0) return 0;
+        if (k <= SMALL_K) {
+            FixedNeighborSet<SMALL_K> neighbors;
+            neighbors.reset(k);
+            search_into(query, neighbors, weights, filter, limits);
+            return neighbors.extract(out_indices, out_distances);
+        }
+        scratch.reset(k);
+        search_into(query, scratch, weights, filter, limits);
+        return scratch.extract(out_indices, out_distances);
+    }
+
+    bool is_leaf(size_t node) const {
+        return node >= ((size_t)1 << levels_) - 1;
+    }
 
 public:
-    // 构造函数
-    KDTree(const Dataset* dataset) : dataset_(dataset), root(nullptr) {
+    // 构造函数；split_seed 非 0 时每个节点在散布最大的几维中随机选分割维度，
+    // 否则按深度轮流选择。build_threads > 1 时并行建树，得到的树与串行建树逐字节相同
+    KDTree(const Dataset* dataset, int leaf_size = DEFAULT_LEAF_SIZE, uint64_t split_seed = 0,
+           int build_threads = 1)
+        : dataset_(dataset), n_features_(dataset ? dataset->n_features : 0),
+          n_points_(0), leaf_size_(std::min(std::max(1, leaf_size), (int)MAX_LEAF_SIZE)),
+          levels_(0), split_seed_(split_seed), nodes_(nullptr), n_nodes_(0), perm_(nullptr), columns_(nullptr),
+          node_storage_(nullptr), perm_storage_(nullptr), mapping_(nullptr),
+          scaled_columns_(nullptr), scaled_splits_(nullptr), scale_(nullptr),
+          baked_weights_(nullptr), prescaled_(false) {
         if (!dataset || dataset->n_samples == 0) return;
-        
-        std::vector<size_t> indices(dataset->n_samples);
-        for (size_t i = 0; i < dataset->n_samples; i++) {
-            indices[i] = i;
+
+        n_points_ = dataset->n_samples;
+
+        // 选择层数，使每个叶子桶不超过 leaf_size_ 个点
+        while (levels_ < MAX_LEVELS &&
+               ((n_points_ + ((size_t)1 << levels_) - 1) >> levels_) > (size_t)leaf_size_) {
+            levels_++;
+        }
+        n_nodes_ = ((size_t)2 << levels_) - 1;
+
+        arena_.reserve(n_nodes_ * sizeof(KDFlatNode) + n_points_ * sizeof(uint32_t) +
+                       n_points_ * n_features_ * sizeof(double) + 3 * Arena::ALIGNMENT);
+        node_storage_ = arena_.allocate_array<KDFlatNode>(n_nodes_);
+        perm_storage_ = arena_.allocate_array<uint32_t>(n_points_);
+        double* column_storage = arena_.allocate_array<double>(n_points_ * n_features_);
+
+        for (size_t i = 0; i < n_points_; i++) {
+            perm_storage_[i] = (uint32_t)i;
+        }
+        // 分块划分的中转区，按绝对位置使用，不同子树互不重叠
+        std::vector<uint32_t> buffer(n_points_ >= PARALLEL_PARTITION_MIN ? n_points_ : 0);
+        ThreadPool* pool = build_threads > 1 && n_points_ >= PARALLEL_BUILD_MIN ?
+            new ThreadPool(build_threads) : nullptr;
+        if (pool) {
+            build_parallel(buffer.data(), *pool);
+        } else {
+            build_tree(0, 0, n_points_, 0, buffer.data());
         }
-        
-        root = build_tree(indices.data(), dataset->n_samples, 0);
+
+        // 按叶子顺序重排坐标并转为列主序，使每个桶的每一维在内存中连续
+        auto transpose = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                const double* row = DatasetStorage::row(dataset_, perm_storage_[i]);
+                for (int d = 0; d < n_features_; d++) {
+                    column_storage[(size_t)d * n_points_ + i] = row[d];
+                }
+            }
+        };
+        if (pool) {
+            pool->parallel_for(n_points_, PARTITION_CHUNK, transpose);
+        } else {
+            transpose(0, n_points_);
+        }
+        delete pool;
+
+        nodes_ = node_storage_;
+        perm_ = perm_storage_;
+        columns_ = column_storage;
     }
 
-    // 析构函数
+    // 析构函数：自建的数组随内存池一起释放
     ~KDTree() {
-        free_tree(root);
+        delete mapping_;
     }
 
+    KDTree(const KDTree&) = delete;
+    KDTree& operator=(const KDTree&) = delete;
+
     // 公共接口
-    std::vector<size_t> find_k_nearest(const double* query, int k, const double* weights) {
-        std::vector<NearestNeighbor> neighbors(k);
-        find_k_nearest_impl(root, query, k, neighbors.data(), weights);
-        
-        std::vector<size_t> result;
-        for (const auto& neighbor : neighbors) {
-            if (neighbor.point) {
-                result.push_back(neighbor.index);
+    // 无分配查询：近邻下标按 (距离, 下标) 升序写入 out_indices，out_distances 非空时
+    // 写入对应的平方距离；返回写出的个数（训练点不足 k 个时小于 k）。
+    // scratch 在同一线程的多次查询间复用。
+    // 维度等于 FEATURE_COUNT 时使用固定维度的特化版本，其他维度走通用版本。
+    // 若已用同一组权重预缩放，则在缩放空间中做普通欧氏搜索（距离为缩放空间中的值，
+    // 与逐项加权的结果只有舍入差异）；权重不同时照常逐项加权，结果始终正确。
+    int find_k_nearest(const double* query, int k, const double* weights, NeighborSet& scratch,
+                       size_t* out_indices, double* out_distances = nullptr) const override {
+        return find_k_nearest_filtered(query, k, weights, scratch, NoFilter(),
+                                       out_indices, out_distances);
+    }
+
+    // 同上，但跳过 filter.excluded(下标) 为真的点（例如已删除的点）
+    template <class Filter>
+    int find_k_nearest_filtered(const double* query, int k, const double* weights,
+                                NeighborSet& scratch, const Filter& filter,
+                                size_t* out_indices, double* out_distances = nullptr) const {
+        return search(query, k, weights, scratch, filter, SearchLimits::from(ApproxParams()),
+                      out_indices, out_distances);
+    }
+
+    // 近似搜索：按 params 放宽剪枝并限制访问的叶子数和距离计算次数，
+    // 返回的近邻仍按 (距离, 下标) 升序。params 为默认值时与 find_k_nearest 完全相同。
+    int find_k_nearest_approx(const double* query, int k, const double* weights,
+                              const ApproxParams& params, NeighborSet& scratch,
+                              size_t* out_indices, double* out_distances = nullptr) const {
+        return search(query, k, weights, scratch, NoFilter(), SearchLimits::from(params),
+                      out_indices, out_distances);
+    }
+
+    std::vector<size_t> find_k_nearest(const double* query, int k, const double* weights) const {
+        NeighborSet scratch;
+        std::vector<size_t> result(k > 0 ? k : 0);
+        result.resize(find_k_nearest(query, k, weights, scratch, result.data()));
+        return result;
+    }
+
+    // 按 weights 生成（或更新）预缩放坐标。已有预缩放时只重算权重变化的维度。
+    // 维度超过 MAX_PRESCALED_DIM 或权重为负时返回 false，保持逐项加权。
+    bool prescale(const double* weights) {
+        if (!weights || n_points_ == 0 || n_features_ > MAX_PRESCALED_DIM) return false;
+        for (int d = 0; d < n_features_; d++) {
+            if (!(weights[d] >= 0.0)) return false;
+        }
+        bool fresh = !scaled_columns_;
+        if (fresh) {
+            scaled_columns_ = arena_.allocate_array<double>(n_points_ * n_features_);
+            scaled_splits_ = arena_.allocate_array<double>(n_nodes_);
+            scale_ = arena_.allocate_array<double>(n_features_);
+            baked_weights_ = arena_.allocate_array<double>(n_features_);
+        }
+        for (int d = 0; d < n_features_; d++) {
+            if (!fresh && prescaled_ && baked_weights_[d] == weights[d]) continue;
+            double scale = sqrt(weights[d]);
+            const double* src = columns_ + (size_t)d * n_points_;
+            double* dst = scaled_columns_ + (size_t)d * n_points_;
+            for (size_t i = 0; i < n_points_; i++) {
+                dst[i] = src[i] * scale;
+            }
+            for (size_t node = 0; node < n_nodes_; node++) {
+                if (nodes_[node].split_dim == d) {
+                    scaled_splits_[node] = nodes_[node].split_value * scale;
+                }
             }
+            scale_[d] = scale;
+            baked_weights_[d] = weights[d];
         }
-        return result;
+        prescaled_ = true;
+        return true;
+    }
+
+    // 回到逐项加权搜索（预缩放数组保留，之后再次 prescale 时复用）
+    void clear_prescale() {
+        prescaled_ = false;
+    }
+
+    bool prescaled_for(const double* weights) const {
+        if (!prescaled_ || !weights) return false;
+        for (int d = 0; d < n_features_; d++) {
+            if (baked_weights_[d] != weights[d]) return false;
+        }
+        return true;
+    }
+
+    const char* name() const override { return "kd-tree"; }
+    size_t size() const override { return n_points_; }
+    int n_features() const override { return n_features_; }
+
+    IndexStats stats() const override {
+        IndexStats stats;
+        stats.points = n_points_;
+        stats.nodes = n_nodes_;
+        stats.depth = levels_;
+        stats.leaf_size = leaf_size_;
+        stats.memory_bytes = mapping_ ? mapping_->size() : arena_.bytes_reserved();
+        return stats;
     }
+
+    size_t node_count() const { return n_nodes_; }
+    bool is_mapped() const { return mapping_ != nullptr; }
+    int leaf_size() const { return leaf_size_; }
 };
 
 // 在类外定义私有成员函数
-void KDTree::free_tree(KDNode* node) {
-    if (!node) return;
-    free_tree(node->left);
-    free_tree(node->right);
-    delete node;
+inline void KDTree::build_tree(size_t node, size_t begin, size_t end, int depth,
+                               uint32_t* buffer) {
+    split_node(node, begin, end, depth, buffer, nullptr);
+    if (depth == levels_) return;
+
+    size_t mid = begin + (end - begin) / 2;
+    build_tree(2 * node + 1, begin, mid, depth + 1, buffer);
+    build_tree(2 * node + 2, mid, end, depth + 1, buffer);
 }
 
-KDNode* KDTree::build_tree(size_t* indices, size_t n_points, int depth) {
-    if (n_points == 0) return nullptr;
+// 上面几层逐层划分：长区间的划分本身由线程池分块完成，同一层的其余节点并行划分；
+// 节点数足够多后，各子树作为独立任务串行建完。每个节点的划分结果与调度无关，
+// 所以与串行建树得到同一棵树
+inline void KDTree::build_parallel(uint32_t* buffer, ThreadPool& pool) {
+    int fork_depth = 0;
+    while (fork_depth < levels_ &&
+           ((size_t)1 << fork_depth) < (size_t)pool.size() * FORK_TASKS_PER_THREAD) {
+        fork_depth++;
+    }
+
+    // 节点范围只取决于父节点范围：左子树取 [begin, mid)，右子树取 [mid, end)
+    auto range_of = [this](size_t node, size_t& begin, size_t& end) {
+        if (node == 0) {
+            begin = 0;
+            end = n_points_;
+            return;
+        }
+        const KDFlatNode& parent = node_storage_[(node - 1) / 2];
+        size_t mid = parent.begin + (parent.end - parent.begin) / 2;
+        bool left = node % 2 == 1;
+        begin = left ? parent.begin : mid;
+        end = left ? mid : parent.end;
+    };
 
-    int split_dim = depth % dataset_->n_features;
-    
-    size_t mid = n_points / 2;
-    std::nth_element(indices, indices + mid, indices + n_points,
-        [this, split_dim](size_t a, size_t b) {
-            return dataset_->data[a].features[split_dim] < 
-                   dataset_->data[b].features[split_dim];
+    for (int depth = 0; depth < fork_depth; depth++) {
+        size_t first = ((size_t)1 << depth) - 1;
+        std::vector<size_t> small;
+        for (size_t node = first; node < 2 * first + 1; node++) {
+            size_t begin, end;
+            range_of(node, begin, end);
+            if (end - begin >= PARALLEL_PARTITION_MIN) {
+                split_node(node, begin, end, depth, buffer, &pool);
+            } else {
+                small.push_back(node);
+            }
+        }
+        pool.parallel_for(small.size(), 1, [&](size_t task_begin, size_t task_end) {
+            for (size_t t = task_begin; t < task_end; t++) {
+                size_t begin, end;
+                range_of(small[t], begin, end);
+                split_node(small[t], begin, end, depth, buffer, nullptr);
+            }
         });
+    }
 
-    const double* point = dataset_->data[indices[mid]].features;
-    KDNode* node = new KDNode(point, indices[mid], split_dim);
+    size_t first = ((size_t)1 << fork_depth) - 1;
+    pool.parallel_for((size_t)1 << fork_depth, 1, [&](size_t task_begin, size_t task_end) {
+        for (size_t t = task_begin; t < task_end; t++) {
+            size_t begin, end;
+            range_of(first + t, begin, end);
+            build_tree(first + t, begin, end, fork_depth, buffer);
+        }
+    });
+}
 
-    node->left = build_tree(indices, mid, depth + 1);
-    node->right = build_tree(indices + mid + 1, n_points - mid - 1, depth + 1);
+// 填写节点范围；内部节点在中位数处划分并记录分割维度和分割值
+inline void KDTree::split_node(size_t node, size_t begin, size_t end, int depth,
+                               uint32_t* buffer, ThreadPool* pool) {
+    KDFlatNode& current = node_storage_[node];
+    current.begin = (uint32_t)begin;
+    current.end = (uint32_t)end;
+    current.reserved = 0;
+    current.split_dim = 0;
+    current.split_value = 0.0;
+    if (depth == levels_) return;
 
-    return node;
+    int split_dim = split_seed_ ? random_split_dim(node, begin, end) : depth % n_features_;
+    size_t mid = begin + (end - begin) / 2;
+    if (mid < end) {
+        select_median(begin, mid, end, split_dim, buffer, pool);
+        current.split_value = DatasetStorage::row(dataset_, perm_storage_[mid])[split_dim];
+    }
+    current.split_dim = split_dim;
 }
 
-void KDTree::find_k_nearest_impl(KDNode* node, const double* query, int k, 
-                               NearestNeighbor* neighbors, const double* weights) {
-    if (!node) return;
+// 使 [begin, mid) 为区间内按 (坐标, 下标) 最小的 mid - begin 个点。
+// 相等坐标按样本下标排序，保证建树结果确定。
+// 长区间先反复按样本中位数做分块稳定划分，把目标位置所在的窗口缩小到阈值以下，
+// 再交给 nth_element。分块边界是固定的，结果与是否使用线程池、线程数都无关
+inline void KDTree::select_median(size_t begin, size_t mid, size_t end, int dim,
+                                  uint32_t* buffer, ThreadPool* pool) {
+    static constexpr size_t SAMPLE_SIZE = 255;
+    auto less = [this, dim](uint32_t a, uint32_t b) { return point_less(a, b, dim); };
+
+    size_t lo = begin, hi = end;
+    std::vector<size_t> below;
+    std::vector<unsigned char> is_below;
+    while (hi - lo >= PARALLEL_PARTITION_MIN) {
+        uint32_t sample[SAMPLE_SIZE];
+        for (size_t i = 0; i < SAMPLE_SIZE; i++) {
+            sample[i] = perm_storage_[lo + (hi - lo) * i / SAMPLE_SIZE];
+        }
+        std::nth_element(sample, sample + SAMPLE_SIZE / 2, sample + SAMPLE_SIZE, less);
+        uint32_t pivot = sample[SAMPLE_SIZE / 2];
 
-    double dist = weights ? 
-        MathUtils::weighted_euclidean_distance(query, node->point, dataset_->n_features, weights) :
-        MathUtils::euclidean_distance(query, node->point, dataset_->n_features);
+        // 每块统计小于 pivot 的个数，前缀和确定各块在两侧的写入位置，再写回原数组
+        size_t n_chunks = (hi - lo + PARTITION_CHUNK - 1) / PARTITION_CHUNK;
+        below.assign(n_chunks + 1, 0);
+        is_below.resize(hi - lo);
+        auto for_chunks = [&](const ThreadPool::RangeFunction& body) {
+            if (pool) {
+                pool->parallel_for(n_chunks, 1, body);
+            } else {
+                body(0, n_chunks);
+            }
+        };
+        for_chunks([&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                size_t chunk_end = std::min(hi, lo + (c + 1) * PARTITION_CHUNK);
+                size_t count = 0;
+                for (size_t i = lo + c * PARTITION_CHUNK; i < chunk_end; i++) {
+                    bool flag = less(perm_storage_[i], pivot);
+                    is_below[i - lo] = flag;
+                    count += flag;
+                }
+                below[c + 1] = count;
+            }
+        });
+        for (size_t c = 0; c < n_chunks; c++) below[c + 1] += below[c];
+        size_t split = lo + below[n_chunks];
+        for_chunks([&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                size_t chunk_begin = lo + c * PARTITION_CHUNK;
+                size_t chunk_end = std::min(hi, chunk_begin + PARTITION_CHUNK);
+                size_t low_pos = lo + below[c];
+                size_t high_pos = split + (chunk_begin - lo) - below[c];
+                for (size_t i = chunk_begin; i < chunk_end; i++) {
+                    uint32_t index = perm_storage_[i];
+                    buffer[is_below[i - lo] ? low_pos++ : high_pos++] = index;
+                }
+            }
+        });
+        for_chunks([&](size_t first, size_t last) {
+            size_t copy_begin = lo + first * PARTITION_CHUNK;
+            size_t copy_end = std::min(hi, lo + last * PARTITION_CHUNK);
+            std::copy(buffer + copy_begin, buffer + copy_end, perm_storage_ + copy_begin);
+        });
 
-    int insert_pos = k - 1;
-    while (insert_pos >= 0 && (neighbors[insert_pos].point == nullptr || 
-           dist < neighbors[insert_pos].distance)) {
-        if (insert_pos < k - 1) {
-            neighbors[insert_pos + 1] = neighbors[insert_pos];
+        // pivot 是样本中位数，两侧都至少有一半样本，窗口严格缩小
+        if (mid < split) {
+            hi = split;
+        } else {
+            lo = split;
         }
-        insert_pos--;
     }
-    insert_pos++;
-    
-    if (insert_pos < k) {
-        neighbors[insert_pos].distance = dist;
-        neighbors[insert_pos].point = node->point;
-        neighbors[insert_pos].index = node->index;
+    std::nth_element(perm_storage_ + lo, perm_storage_ + mid, perm_storage_ + hi, less);
+}
+
+// 在 [begin, end) 的等距采样上统计各维散布，从最大的几维中按 (种子, 节点) 确定地随机选一维。
+// 只依赖节点自身，与建树顺序无关。
+inline int KDTree::random_split_dim(size_t node, size_t begin, size_t end) const {
+    static constexpr size_t SAMPLE_SIZE = 128;
+    static constexpr int CANDIDATES = 5;
+
+    std::vector<double> low(n_features_, INFINITY), high(n_features_, -INFINITY);
+    size_t step = std::max((size_t)1, (end - begin) / SAMPLE_SIZE);
+    for (size_t i = begin; i < end; i += step) {
+        const double* row = DatasetStorage::row(dataset_, perm_storage_[i]);
+        for (int d = 0; d < n_features_; d++) {
+            low[d] = std::min(low[d], row[d]);
+            high[d] = std::max(high[d], row[d]);
+        }
     }
+    std::vector<int> dims(n_features_);
+    for (int d = 0; d < n_features_; d++) dims[d] = d;
+    int n_candidates = std::min(CANDIDATES, n_features_);
+    std::partial_sort(dims.begin(), dims.begin() + n_candidates, dims.end(),
+        [&low, &high](int a, int b) {
+            double sa = high[a] - low[a], sb = high[b] - low[b];
+            return sa > sb || (sa == sb && a < b);
+        });
 
-    double split_dist = query[node->split_dim] - node->point[node->split_dim];
-    if (weights) {
-        split_dist *= weights[node->split_dim];
+    // splitmix64
+    uint64_t x = split_seed_ + (node + 1) * 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return dims[x % n_candidates];
+}
+
+// 用 SIMD 内核一次算出整个桶的平方距离，再逐个尝试插入
+template <int DIM, int METRIC, bool SCALED, class Neighbors, class Filter>
+inline void KDTree::scan_leaf(const KDFlatNode& leaf, const double* query,
+                              BlockDistanceKernel kernel, Neighbors& neighbors,
+                              const double* weights, const Filter& filter) const {
+    double dist[MAX_LEAF_SIZE];
+    size_t count = leaf.end - leaf.begin;
+    const double* columns = SCALED ? scaled_columns_ : columns_;
+    kernel(query, columns + leaf.begin, n_points_, count, n_features_, weights, dist);
+    for (size_t i = 0; i < count; i++) {
+        size_t index = perm_[leaf.begin + i];
+        if (neighbors.accepts(dist[i], index) && !filter.excluded(index)) {
+            neighbors.push(dist[i], index);
+        }
     }
+}
+
+// 用显式栈代替递归；每个待访问节点带一个到查询点的平方距离下界。
+// 全程比较平方距离，不做开方。近似搜索时下界先乘以 (1+ε)^2 再比较，
+// 并在叶子数或距离计算次数用完后停止。
+template <int DIM, int METRIC, bool SCALED, class Neighbors, class Filter>
+inline void KDTree::find_k_nearest_impl(const double* query, Neighbors& neighbors,
+                                        const double* weights, const Filter& filter,
+                                        const SearchLimits& limits) const {
+    BlockDistanceKernel kernel = MathUtils::block_kernel<DIM, METRIC>();
+    struct StackEntry {
+        size_t node;
+        double bound;
+    };
+    StackEntry stack[MAX_LEVELS + 2];
+    int top = 0;
+    stack[top++] = {0, 0.0};
+    size_t leaves_left = limits.max_leaves;
+    size_t evaluations_left = limits.max_evaluations;
+    KNN_STATS(QueryCounters counters = QueryCounters();)
+
+    while (top > 0) {
+        StackEntry entry = stack[--top];
+        // 下界与第 k 近距离相等时仍需访问，其中可能有下标更小的等距点
+        if (entry.bound * limits.prune_scale > neighbors.bound()) {
+            KNN_STATS(counters.subtrees_pruned++;)
+            continue;
+        }
+
+        size_t node = entry.node;
+        while (!is_leaf(node)) {
+            KNN_STATS(counters.nodes_visited++;)
+            const KDFlatNode& current = nodes_[node];
+            double split_value = SCALED ? scaled_splits_[node] : current.split_value;
+            double split_dist = query[current.split_dim] - split_value;
+            // 与距离内核相同的运算顺序 (w·d)·d，保证下界不会因舍入超过该维对距离的贡献
+            double gap = METRIC == METRIC_WEIGHTED ?
+                weights[current.split_dim] * split_dist * split_dist : split_dist * split_dist;
 
-    KDNode* first = split_dist <= 0 ? node->left : node->right;
-    KDNode* second = split_dist <= 0 ? node->right : node->left;
+            size_t first = split_dist < 0 ? 2 * node + 1 : 2 * node + 2;
+            size_t second = split_dist < 0 ? 2 * node + 2 : 2 * node + 1;
 
-    find_k_nearest_impl(first, query, k, neighbors, weights);
+            // 另一侧子树稍后访问，下界取父节点下界与分割面距离中的较大者
+            stack[top++] = {second, std::max(entry.bound, gap)};
+            KNN_STATS(counters.max_stack_depth = std::max(counters.max_stack_depth,
+                                                          (unsigned long long)top);)
+            node = first;
+        }
+        const KDFlatNode& leaf = nodes_[node];
+        scan_leaf<DIM, METRIC, SCALED>(leaf, query, kernel, neighbors, weights, filter);
 
-    if (neighbors[k-1].point == nullptr || 
-        std::abs(split_dist) < neighbors[k-1].distance) {
-        find_k_nearest_impl(second, query, k, neighbors, weights);
+        size_t evaluated = leaf.end - leaf.begin;
+        KNN_STATS(counters.nodes_visited++; counters.distance_evaluations += evaluated;)
+        if (--leaves_left == 0 || evaluated >= evaluations_left) break;
+        evaluations_left -= evaluated;
     }
+    KNN_STATS(SearchStats::record_search(counters);)
 }
 
 #endif // KDTREE_H
\ No newline at end of file
@@ -0,0 +1,203 @@
+#ifndef KDTREE_IO_H
+#define KDTREE_IO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "kdtree.h"
+
+// KD 树索引文件（本机字节序，各段 64 字节对齐）：
+//   KDTreeIndexHeader
+//   节点数组     n_nodes 个 KDFlatNode（广度优先顺序）
+//   点排列       n_points 个 uint32
+//   列主序坐标   n_features × n_points 个 double
+// 结构中没有指针，打开时只读映射即可查询；多个进程映射同一文件时共享物理页。
+struct KDTreeIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian_tag;
+    uint64_t header_size;
+    uint64_t n_points;
+    uint64_t n_features;
+    uint64_t leaf_size;
+    uint64_t levels;
+    uint64_t n_nodes;
+    uint64_t nodes_offset;
+    uint64_t perm_offset;
+    uint64_t columns_offset;
+    uint64_t file_size;
+    uint64_t payload_checksum;  // 从 nodes_offset 到文件末尾的 FNV-1a
+    uint64_t dataset_digest;    // 训练集全部坐标的摘要，用于发现索引与数据不匹配
+};
+
+class KDTreeIndexFile {
+public:
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+
+    static bool save(const KDTree& tree, const char* path) {
+        KDTreeIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.endian_tag = ENDIAN_TAG;
+        header.header_size = sizeof(KDTreeIndexHeader);
+        header.n_points = tree.n_points_;
+        header.n_features = tree.n_features_;
+        header.leaf_size = tree.leaf_size_;
+        header.levels = tree.levels_;
+        header.n_nodes = tree.n_nodes_;
+        header.nodes_offset = align(sizeof(KDTreeIndexHeader));
+        header.perm_offset = align(header.nodes_offset + tree.n_nodes_ * sizeof(KDFlatNode));
+        header.columns_offset = align(header.perm_offset + tree.n_points_ * sizeof(uint32_t));
+        header.file_size = header.columns_offset +
+                           tree.n_points_ * tree.n_features_ * sizeof(double);
+        header.dataset_digest = dataset_digest(tree.dataset_);
+
+        // 各段直接从树中写出，边写边累计负载校验和（段之间的填充为零），
+        // 最后回到文件开头写入带校验和的文件头，不在内存中另拼一份负载
+        std::string tmp_path = std::string(path) + ".tmp";
+        FILE* file = fopen(tmp_path.c_str(), "wb");
+        if (!file) return false;
+        uint64_t offset = 0;
+        uint64_t checksum = FNV_OFFSET;
+        bool ok = write_section(file, &offset, 0, &header, sizeof(header), nullptr) &&
+                  write_section(file, &offset, header.nodes_offset, nullptr, 0, nullptr) &&
+                  write_section(file, &offset, header.nodes_offset, tree.nodes_,
+                                tree.n_nodes_ * sizeof(KDFlatNode), &checksum) &&
+                  write_section(file, &offset, header.perm_offset, tree.perm_,
+                                tree.n_points_ * sizeof(uint32_t), &checksum) &&
+                  write_section(file, &offset, header.columns_offset, tree.columns_,
+                                tree.n_points_ * tree.n_features_ * sizeof(double), &checksum);
+        header.payload_checksum = checksum;
+        ok = ok && fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+        ok = fclose(file) == 0 && ok;
+        if (!ok) {
+            remove(tmp_path.c_str());
+            return false;
+        }
+        remove(path);
+        return rename(tmp_path.c_str(), path) == 0;
+    }
+
+    // 映射打开索引。格式、校验和或训练集不匹配时返回 nullptr。
+    // verify_checksum 为 false 时跳过全文件校验，打开不触碰负载页面。
+    static KDTree* open(const char* path, const Dataset* dataset, bool verify_checksum = true) {
+        if (!dataset) return nullptr;
+        MappedFile* file = new MappedFile(path);
+        if (!file->is_open() || file->size() < sizeof(KDTreeIndexHeader)) {
+            delete file;
+            return nullptr;
+        }
+
+        KDTreeIndexHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        bool ok = header_valid(header, file->size()) &&
+                  header.n_points == (uint64_t)dataset->n_samples &&
+                  header.n_features == (uint64_t)dataset->n_features &&
+                  header.dataset_digest == dataset_digest(dataset);
+        if (ok && verify_checksum) {
+            ok = fnv1a(FNV_OFFSET, file->data() + header.nodes_offset,
+                       header.file_size - header.nodes_offset) == header.payload_checksum;
+        }
+        if (!ok) {
+            delete file;
+            return nullptr;
+        }
+
+        KDTree* tree = new KDTree(nullptr);
+        tree->dataset_ = dataset;
+        tree->n_features_ = (int)header.n_features;
+        tree->n_points_ = header.n_points;
+        tree->leaf_size_ = (int)header.leaf_size;
+        tree->levels_ = (int)header.levels;
+        tree->n_nodes_ = header.n_nodes;
+        tree->nodes_ = reinterpret_cast<const KDFlatNode*>(file->data() + header.nodes_offset);
+        tree->perm_ = reinterpret_cast<const uint32_t*>(file->data() + header.perm_offset);
+        tree->columns_ = reinterpret_cast<const double*>(file->data() + header.columns_offset);
+        tree->mapping_ = file;
+        return tree;
+    }
+
+    // 索引有效时映射打开，否则用 build_threads 个线程重新建树并写入索引文件
+    static KDTree* load_or_build(const char* path, const Dataset* dataset, int build_threads = 1) {
+        KDTree* tree = open(path, dataset);
+        if (tree) return tree;
+
+        tree = new KDTree(dataset, KDTree::DEFAULT_LEAF_SIZE, 0, build_threads);
+        if (!save(*tree, path)) {
+            printf("警告：无法写入索引文件 %s\n", path);
+        }
+        return tree;
+    }
+
+private:
+    static constexpr const char* MAGIC = "KNNTREE";
+    static constexpr uint64_t SECTION_ALIGNMENT = 64;
+    static constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    }
+
+    // 先补零填充到 section_offset，再写出该段；checksum 非空时填充和段内容都计入校验和
+    static bool write_section(FILE* file, uint64_t* offset, uint64_t section_offset,
+                              const void* data, size_t bytes, uint64_t* checksum) {
+        static const char zeros[SECTION_ALIGNMENT] = {};
+        while (*offset < section_offset) {
+            size_t n = (size_t)std::min<uint64_t>(section_offset - *offset, sizeof(zeros));
+            if (fwrite(zeros, 1, n, file) != n) return false;
+            if (checksum) *checksum = fnv1a(*checksum, zeros, n);
+            *offset += n;
+        }
+        if (bytes && fwrite(data, 1, bytes, file) != bytes) return false;
+        if (checksum) *checksum = fnv1a(*checksum, static_cast<const char*>(data), bytes);
+        *offset += bytes;
+        return true;
+    }
+
+    static bool header_valid(const KDTreeIndexHeader& header, size_t file_size) {
+        if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != VERSION || header.endian_tag != ENDIAN_TAG ||
+            header.header_size != sizeof(KDTreeIndexHeader) ||
+            header.file_size != file_size || header.levels > (uint64_t)KDTree::MAX_LEVELS ||
+            header.leaf_size == 0 || header.leaf_size > (uint64_t)KDTree::MAX_LEAF_SIZE) {
+            return false;
+        }
+        return header.n_nodes == (((uint64_t)2 << header.levels) - 1) &&
+               header.perm_offset >= header.nodes_offset + header.n_nodes * sizeof(KDFlatNode) &&
+               header.columns_offset >= header.perm_offset + header.n_points * sizeof(uint32_t) &&
+               header.file_size == header.columns_offset +
+                                   header.n_points * header.n_features * sizeof(double);
+    }
+
+    // 训练集的行数、维度和全部坐标的摘要：任何一个坐标改变都会使索引失效。
+    // 按 64 位字（坐标的位模式）做 FNV-1a，代价与数据规模成正比，但远小于重新建树
+    static uint64_t dataset_digest(const Dataset* dataset) {
+        uint64_t hash = FNV_OFFSET;
+        uint64_t shape[2] = {dataset ? (uint64_t)dataset->n_samples : 0,
+                             dataset ? (uint64_t)dataset->n_features : 0};
+        hash = fnv1a(hash, reinterpret_cast<const char*>(shape), sizeof(shape));
+        size_t count = shape[0] * shape[1];
+        const double* values = count ? DatasetStorage::row(dataset, 0) : nullptr;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t word;
+            memcpy(&word, values + i, sizeof(word));
+            hash ^= word;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static uint64_t fnv1a(uint64_t hash, const char* data, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+#endif // KDTREE_IO_H
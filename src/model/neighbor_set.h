@@ -0,0 +1,212 @@
+#ifndef NEIGHBOR_SET_H
+#define NEIGHBOR_SET_H
+
+#include <stddef.h>
+#include <cmath>
+#include <vector>
+
+struct NearestNeighbor {
+    double distance;        // 平方距离
+    size_t index;
+};
+
+// 候选点是否排在 neighbor 之前：按距离升序，距离相同时按样本下标升序。
+// 统一的次序保证不同引擎、不同遍历顺序得到同一组近邻。
+inline bool neighbor_precedes(double dist, size_t index, const NearestNeighbor& neighbor) {
+    return dist < neighbor.distance || (dist == neighbor.distance && index < neighbor.index);
+}
+
+// 单次查询的有界 k 近邻集合，可在同一线程的多次查询间复用，容量够用后不再分配。
+// k 较小时维护有序数组（插入为短距离移动）；k 较大时改用以最远者为堆顶的二叉堆，
+// 插入为 O(log k)。
+class NeighborSet {
+public:
+    static constexpr int HEAP_MIN_K = 32;
+
+    NeighborSet() : k_(0), count_(0) {}
+
+    // 开始一次新查询
+    void reset(int k) {
+        k_ = k > 0 ? k : 0;
+        count_ = 0;
+        if (items_.size() < (size_t)k_) items_.resize(k_);
+    }
+
+    int k() const { return k_; }
+    int size() const { return count_; }
+
+    // 第 k 近的平方距离；不足 k 个时为无穷大，任何下界都不能剪枝
+    double bound() const {
+        return count_ < k_ ? INFINITY : worst().distance;
+    }
+
+    bool accepts(double dist, size_t index) const {
+        return count_ < k_ || neighbor_precedes(dist, index, worst());
+    }
+
+    // 调用前应先确认 accepts() 为真
+    void push(double dist, size_t index) {
+        NearestNeighbor item = {dist, index};
+        if (k_ >= HEAP_MIN_K) {
+            if (count_ < k_) {
+                sift_up(count_++, item);
+            } else {
+                sift_down(0, item);
+            }
+            return;
+        }
+
+        int pos = count_ < k_ ? count_++ : k_ - 1;
+        while (pos > 0 && neighbor_precedes(dist, index, items_[pos - 1])) {
+            items_[pos] = items_[pos - 1];
+            pos--;
+        }
+        items_[pos] = item;
+    }
+
+    // 按 (距离, 下标) 升序写出结果，返回个数；distances 可为空。
+    // 堆模式下会就地排序，之后需 reset() 才能继续插入。
+    int extract(size_t* indices, double* distances) {
+        if (k_ >= HEAP_MIN_K) sort_heap();
+        for (int i = 0; i < count_; i++) {
+            indices[i] = items_[i].index;
+            if (distances) distances[i] = items_[i].distance;
+        }
+        return count_;
+    }
+
+private:
+    std::vector<NearestNeighbor> items_;
+    int k_;
+    int count_;
+
+    const NearestNeighbor& worst() const {
+        return k_ >= HEAP_MIN_K ? items_[0] : items_[count_ - 1];
+    }
+
+    static bool after(const NearestNeighbor& a, const NearestNeighbor& b) {
+        return neighbor_precedes(b.distance, b.index, a);
+    }
+
+    void sift_up(int pos, const NearestNeighbor& item) {
+        while (pos > 0) {
+            int parent = (pos - 1) / 2;
+            if (!after(item, items_[parent])) break;
+            items_[pos] = items_[parent];
+            pos = parent;
+        }
+        items_[pos] = item;
+    }
+
+    // 用 item 替换 pos 处的元素并下沉，堆大小为 count_
+    void sift_down(int pos, const NearestNeighbor& item) {
+        while (true) {
+            int child = 2 * pos + 1;
+            if (child >= count_) break;
+            if (child + 1 < count_ && after(items_[child + 1], items_[child])) child++;
+            if (!after(items_[child], item)) break;
+            items_[pos] = items_[child];
+            pos = child;
+        }
+        items_[pos] = item;
+    }
+
+    // 反复把堆顶（最远者）换到末尾，得到升序数组
+    void sort_heap() {
+        int n = count_;
+        while (count_ > 1) {
+            NearestNeighbor last = items_[count_ - 1];
+            items_[count_ - 1] = items_[0];
+            count_--;
+            sift_down(0, last);
+        }
+        count_ = n;
+    }
+};
+
+// 容量在编译期固定的小 k 近邻集合，放在栈上，接口与 NeighborSet 相同。
+// 循环上界为常量，编译器可以把候选数组留在寄存器或 L1 中。要求 k <= KMAX。
+template <int KMAX>
+class FixedNeighborSet {
+public:
+    FixedNeighborSet() : k_(0), count_(0) {}
+
+    void reset(int k) {
+        k_ = k < KMAX ? (k > 0 ? k : 0) : KMAX;
+        count_ = 0;
+    }
+
+    int k() const { return k_; }
+    int size() const { return count_; }
+
+    double bound() const {
+        return count_ < k_ ? INFINITY : items_[count_ - 1].distance;
+    }
+
+    bool accepts(double dist, size_t index) const {
+        return count_ < k_ || neighbor_precedes(dist, index, items_[count_ - 1]);
+    }
+
+    void push(double dist, size_t index) {
+        int pos = count_ < k_ ? count_++ : k_ - 1;
+        while (pos > 0 && neighbor_precedes(dist, index, items_[pos - 1])) {
+            items_[pos] = items_[pos - 1];
+            pos--;
+        }
+        items_[pos].distance = dist;
+        items_[pos].index = index;
+    }
+
+    int extract(size_t* indices, double* distances) const {
+        for (int i = 0; i < count_; i++) {
+            indices[i] = items_[i].index;
+            if (distances) distances[i] = items_[i].distance;
+        }
+        return count_;
+    }
+
+private:
+    NearestNeighbor items_[KMAX];
+    int k_;
+    int count_;
+};
+
+// 批量查询结果：n_queries × k 的近邻下标矩阵和平方距离矩阵（行主序连续存放）。
+// 训练点不足 k 个时，第 i 行只有前 count(i) 个有效。resize 保留已有容量，可反复复用。
+class NeighborMatrix {
+public:
+    NeighborMatrix() : n_queries_(0), k_(0) {}
+
+    void resize(size_t n_queries, int k) {
+        n_queries_ = n_queries;
+        k_ = k > 0 ? k : 0;
+        indices_.resize(n_queries_ * k_);
+        distances_.resize(n_queries_ * k_);
+        counts_.resize(n_queries_);
+    }
+
+    size_t rows() const { return n_queries_; }
+    int k() const { return k_; }
+
+    size_t* indices(size_t row) { return indices_.data() + row * k_; }
+    const size_t* indices(size_t row) const { return indices_.data() + row * k_; }
+    double* distances(size_t row) { return distances_.data() + row * k_; }
+    const double* distances(size_t row) const { return distances_.data() + row * k_; }
+
+    int count(size_t row) const { return counts_[row]; }
+    void set_count(size_t row, int count) { counts_[row] = count; }
+
+    // 写出 set 中的结果作为第 row 行
+    void store(size_t row, NeighborSet& set) {
+        counts_[row] = set.extract(indices(row), distances(row));
+    }
+
+private:
+    size_t n_queries_;
+    int k_;
+    std::vector<size_t> indices_;
+    std::vector<double> distances_;
+    std::vector<int> counts_;
+};
+
+#endif // NEIGHBOR_SET_H
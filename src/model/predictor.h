@@ -1,33 +1,170 @@
 #ifndef PREDICTOR_H
 #define PREDICTOR_H
 
+#include <mutex>
+#include <atomic>
 #include "kdtree.h"
+#include "kdtree_io.h"
+#include "brute_force.h"
+#include "ball_tree.h"
+#include "dual_tree.h"
+#include "sharded_index.h"
 #include "adaptive_weights.h"
+#include "../utils/thread_pool.h"
+
+// 近邻搜索引擎
+enum SearchEngine {
+    ENGINE_AUTO,        // 根据数据规模和维度自动选择
+    ENGINE_KDTREE,
+    ENGINE_BRUTE_FORCE,
+    ENGINE_BALL_TREE,       // 只在显式指定时建立
+    ENGINE_DUAL_TREE,       // 整批查询建树与 KD 树双树遍历，只在显式指定时建立
+    ENGINE_SHARDED          // 按 NUMA 节点分片的索引（或连接的其他进程中的分片），只在显式指定时建立
+};
 
 class Predictor {
 public:
-    Predictor(const Dataset* train_data, const double* weights) 
+    // index_path 非空时优先映射打开预建的 KD 树索引，无效则重新建树并写入该文件
+    Predictor(const Dataset* train_data, const double* weights,
+              const char* index_path = nullptr)
         : train_data_(train_data),
-          kdtree_(new KDTree(train_data)),
+          kdtree_(index_path ? KDTreeIndexFile::load_or_build(index_path, train_data,
+                                                              ThreadPool::default_threads())
+                             : build_tree(train_data)),
           static_weights_(weights),
           adaptive_weights_(nullptr),
-          use_adaptive_(false) {}
+          use_adaptive_(false),
+          adaptive_batch_(0),
+          num_threads_(1),
+          pool_(nullptr),
+          prescaled_(false),
+          ball_tree_(nullptr),
+          dual_tree_(nullptr),
+          sharded_(nullptr) {
+        init_engines();
+    }
 
     Predictor(const Dataset* train_data, bool use_adaptive = true) 
         : train_data_(train_data),
-          kdtree_(new KDTree(train_data)),
+          kdtree_(build_tree(train_data)),
           static_weights_(nullptr),
           adaptive_weights_(use_adaptive ? new AdaptiveWeights(train_data->n_features) : nullptr),
-          use_adaptive_(use_adaptive) {}
+          use_adaptive_(use_adaptive),
+          adaptive_batch_(0),
+          num_threads_(1),
+          pool_(nullptr),
+          prescaled_(false),
+          ball_tree_(nullptr),
+          dual_tree_(nullptr),
+          sharded_(nullptr) {
+        init_engines();
+    }
 
     ~Predictor() {
+        delete pool_;
         delete kdtree_;
+        delete brute_force_;
+        delete ball_tree_;
+        delete dual_tree_;
+        delete sharded_;
         delete adaptive_weights_;
     }
 
+    // 批量预测使用的线程数（<= 0 表示使用全部硬件线程）。
+    // 自适应权重模式只有在设置了小批量大小后才并行执行。
+    void set_num_threads(int num_threads) {
+        if (num_threads <= 0) num_threads = ThreadPool::default_threads();
+        if (num_threads == num_threads_) return;
+        num_threads_ = num_threads;
+        delete pool_;
+        pool_ = nullptr;
+    }
+
+    int num_threads() const { return num_threads_; }
+
+    // 自适应权重的小批量大小；0（默认）为逐条更新。批内查询并行执行、共用批开始时的权重，
+    // 因此结果与逐条模式不同，但与线程数无关
+    void set_adaptive_batch(size_t batch_size) { adaptive_batch_ = batch_size; }
+    size_t adaptive_batch() const { return adaptive_batch_; }
+
+    // 指定搜索引擎；ENGINE_AUTO 会重新进行自动选择。球树第一次被选中时按当前权重建立。
+    // 双树引擎只用于批量预测，逐条查询（自适应模式）仍走 KD 树
+    void set_engine(SearchEngine engine) {
+        engine_ = engine == ENGINE_AUTO ? choose_engine() : engine;
+        if (engine_ == ENGINE_BALL_TREE && !ball_tree_) {
+            ball_tree_ = new BallTree(train_data_, current_weights());
+        }
+        if (engine_ == ENGINE_DUAL_TREE && !dual_tree_) {
+            dual_tree_ = new DualTreeKNN(kdtree_);
+        }
+        if (engine_ == ENGINE_SHARDED && !sharded_) {
+            sharded_ = new ShardedIndex(train_data_);
+        }
+    }
+
+    // 改用给定的分片索引（例如 ShardedIndex::connect 连接的其他进程中的分片）并取得所有权；
+    // 分片须覆盖与 train_data 相同的训练集
+    void set_sharded_index(ShardedIndex* index) {
+        delete sharded_;
+        sharded_ = index;
+        engine_ = ENGINE_SHARDED;
+    }
+
+    SearchEngine engine() const { return engine_; }
+
+    // 暴力引擎的坐标存储精度：低精度坐标只用来排除不可能的候选，预测结果不变
+    void set_storage_precision(StoragePrecision precision) {
+        if (precision == brute_force_->precision()) return;
+        delete brute_force_;
+        brute_force_ = new BruteForceKNN(train_data_, precision);
+    }
+
+    // 当前引擎对应的索引
+    const SpatialIndex* index() const {
+        switch (engine_) {
+            case ENGINE_BRUTE_FORCE: return brute_force_;
+            case ENGINE_BALL_TREE: return ball_tree_;
+            case ENGINE_SHARDED: return sharded_;
+            default: return kdtree_;
+        }
+    }
+
+    // KD 树在 sqrt(权重) 缩放后的坐标上做普通欧氏搜索，默认关闭。
+    // 缩放空间中的距离与逐项加权的距离有舍入差异，等距点的先后和恰好在第 k 近处的点
+    // 可能不同，因此开启后结果不再与暴力、球树、双树等引擎逐位相同。
+    // 权重变化后在下一批查询前增量重算（自适应模式下每 PRESCALE_INTERVAL 条查询一次，
+    // 其间的查询照常逐项加权）。
+    void set_prescaled(bool enabled) {
+        prescaled_ = enabled;
+        if (enabled) {
+            refresh_prescale(current_weights());
+        } else {
+            kdtree_->clear_prescale();
+        }
+    }
+
+    bool prescaled() const { return prescaled_; }
+
+    // KD 树引擎的近似搜索参数（默认精确）；暴力引擎始终精确
+    void set_approx(const ApproxParams& params) { approx_ = params; }
+    const ApproxParams& approx() const { return approx_; }
+
+    static const char* engine_name(SearchEngine engine) {
+        switch (engine) {
+            case ENGINE_KDTREE: return "kd-tree";
+            case ENGINE_BRUTE_FORCE: return "brute-force";
+            case ENGINE_BALL_TREE: return "ball-tree";
+            case ENGINE_DUAL_TREE: return "dual-tree";
+            case ENGINE_SHARDED: return "sharded";
+            default: return "auto";
+        }
+    }
+
+    // 查询失败（例如分片服务断开）时返回空向量
     std::vector<int> predict(const Dataset* test_data, int k) {
         if (use_adaptive_) {
-            return predict_adaptive(test_data, k);
+            return adaptive_batch_ > 0 ? predict_adaptive_batched(test_data, k) :
+                                         predict_adaptive(test_data, k);
         } else {
             return predict_static(test_data, k);
         }
@@ -42,67 +179,195 @@ public:
         }
     }
 
-    void predict_with_neighbors(const Dataset* test_data, int k,
+    // 近邻写入扁平的 n × k 矩阵；predictions 和 neighbors 可跨调用复用，容量够用后不再分配。
+    // 查询失败时返回 false，此时 predictions 不可用
+    bool predict_with_neighbors(const Dataset* test_data, int k,
                               std::vector<int>& predictions,
-                              std::vector<std::vector<size_t>>& all_neighbors) {
-        predictions.clear();
-        all_neighbors.clear();
-        predictions.reserve(test_data->n_samples);
-        all_neighbors.reserve(test_data->n_samples);
+                              NeighborMatrix& neighbors) {
+        // 每条查询写入自己的行，并行与串行的输出完全一致
+        predictions.assign(test_data->n_samples, 0);
+        neighbors.resize(test_data->n_samples, k);
+        const double* weights = current_weights();
+        refresh_prescale(weights);
 
-        for (int i = 0; i < test_data->n_samples; i++) {
-            auto neighbors = kdtree_->find_k_nearest(
-                test_data->data[i].features, k, 
-                use_adaptive_ ? adaptive_weights_->get_weights().data() : static_weights_);
-            
-            all_neighbors.push_back(neighbors);
-            
-            // 投票预测
-            int survived_votes = 0;
-            for (size_t idx : neighbors) {
-                survived_votes += train_data_->data[idx].survived;
+        KNN_STATS(auto batch_start = SearchStats::now();)
+        // 分片索引一次只处理一批，整批交给它，由各分片的线程组并行
+        size_t chunk = engine_ == ENGINE_DUAL_TREE ? DUAL_TREE_CHUNK :
+                       engine_ == ENGINE_SHARDED ? std::max<size_t>(test_data->n_samples, 1) :
+                       QUERY_CHUNK;
+        std::atomic<bool> ok(true);
+        for_each_query(test_data->n_samples, chunk, [&](size_t begin, size_t end) {
+            if (!search_range(test_data, begin, end, k, weights, neighbors)) {
+                ok = false;
+                return;
             }
-            
-            predictions.push_back(2 * survived_votes >= neighbors.size());
-        }
+            for (size_t i = begin; i < end; i++) {
+                predictions[i] = make_prediction(neighbors.indices(i), neighbors.count(i));
+            }
+        });
+        KNN_STATS(SearchStats::record_batch_latency(batch_start);)
+        return ok;
     }
 
 private:
     const Dataset* train_data_;
     KDTree* kdtree_;
+    BruteForceKNN* brute_force_;
+    SearchEngine engine_;
     const double* static_weights_;
     AdaptiveWeights* adaptive_weights_;
     bool use_adaptive_;
+    size_t adaptive_batch_;
+    int num_threads_;
+    ThreadPool* pool_;
+    NeighborMatrix neighbor_buffer_;    // predict() 内部使用的近邻矩阵
+    bool prescaled_;
+    ApproxParams approx_;
+    BallTree* ball_tree_;
+    DualTreeKNN* dual_tree_;
+    ShardedIndex* sharded_;
 
-    std::vector<int> predict_static(const Dataset* test_data, int k) {
-        std::vector<int> predictions;
-        predictions.reserve(test_data->n_samples);
+    // 每个线程一份的查询缓冲，线程池的工作线程在各批次之间复用
+    struct QueryScratch {
+        NeighborSet neighbors;
+        FeedbackAccumulator feedback;   // 小批量自适应模式下本线程的特征反馈
+        NeighborMatrix single;          // 分片引擎单条查询的结果
+    };
 
-        for (int i = 0; i < test_data->n_samples; i++) {
-            auto neighbors = kdtree_->find_k_nearest(
-                test_data->data[i].features, k, static_weights_);
-            predictions.push_back(make_prediction(neighbors));
+    static QueryScratch& thread_scratch() {
+        static thread_local QueryScratch scratch;
+        return scratch;
+    }
+
+    static constexpr size_t QUERY_CHUNK = 64;
+    static constexpr size_t DUAL_TREE_CHUNK = 8192;     // 每块查询建一棵查询树，块越大共享的剪枝越多
+    static constexpr int PRESCALE_INTERVAL = 256;
+
+    // 自动选择引擎的阈值
+    static constexpr size_t BRUTE_FORCE_MAX_POINTS = 256;    // 树只有寥寥几个叶子
+    static constexpr int BRUTE_FORCE_MIN_DIM = 16;           // 高维下 KD 树几乎不剪枝
+
+    // 建树用全部硬件线程，结果与串行建树相同
+    static KDTree* build_tree(const Dataset* train_data) {
+        return new KDTree(train_data, KDTree::DEFAULT_LEAF_SIZE, 0, ThreadPool::default_threads());
+    }
+
+    void init_engines() {
+        brute_force_ = new BruteForceKNN(train_data_);
+        engine_ = choose_engine();
+    }
+
+    const double* current_weights() const {
+        return use_adaptive_ ? adaptive_weights_->get_weights().data() : static_weights_;
+    }
+
+    void refresh_prescale(const double* weights) {
+        if (prescaled_ && !kdtree_->prescaled_for(weights)) {
+            kdtree_->prescale(weights);
+        }
+    }
+
+    // 只按规模和维度选择，同样的数据总是得到同样的引擎
+    SearchEngine choose_engine() const {
+        if ((size_t)train_data_->n_samples <= BRUTE_FORCE_MAX_POINTS ||
+            train_data_->n_features >= BRUTE_FORCE_MIN_DIM) {
+            return ENGINE_BRUTE_FORCE;
+        }
+        return ENGINE_KDTREE;
+    }
+
+    // 查询 test_data 的第 [begin, end) 行，结果写入 out 的同名行；只有分片查询会失败
+    bool search_range(const Dataset* test_data, size_t begin, size_t end, int k,
+                      const double* weights, NeighborMatrix& out) const {
+        if (engine_ != ENGINE_KDTREE) {
+            // 批量引擎整块一次调用，无法逐条计时；统计开启时按块记录耗时
+            KNN_STATS(auto start = SearchStats::now();)
+            bool ok = search_batch(DatasetStorage::row(test_data, begin), end - begin, k,
+                                   weights, out, begin);
+            KNN_STATS(SearchStats::record_chunk_latency(start, end - begin);)
+            return ok;
+        }
+        QueryScratch& scratch = thread_scratch();
+        for (size_t i = begin; i < end; i++) {
+            KNN_STATS(auto start = SearchStats::now();)
+            out.set_count(i, kdtree_->find_k_nearest_approx(DatasetStorage::row(test_data, i), k,
+                                                            weights, approx_, scratch.neighbors,
+                                                            out.indices(i), out.distances(i)));
+            KNN_STATS(SearchStats::record_query_latency(start);)
         }
+        return true;
+    }
+
+    bool search_batch(const double* queries, size_t n, int k, const double* weights,
+                      NeighborMatrix& out, size_t first_row) const {
+        switch (engine_) {
+            case ENGINE_DUAL_TREE:
+                dual_tree_->find_k_nearest_batch(queries, n, k, weights, out, first_row);
+                return true;
+            case ENGINE_SHARDED:
+                return sharded_->search_batch(queries, n, k, weights, out, first_row);
+            default:
+                index()->find_k_nearest_batch(queries, n, k, weights, out, first_row);
+                return true;
+        }
+    }
+
+    // 单条查询，返回近邻数；分片查询失败时返回 -1
+    int search_one(const double* query, int k, const double* weights, size_t* out) const {
+        NeighborSet& scratch = thread_scratch().neighbors;
+        if (engine_ == ENGINE_SHARDED) {
+            NeighborMatrix& single = thread_scratch().single;
+            single.resize(1, k);
+            if (!sharded_->search_batch(query, 1, k, weights, single, 0)) return -1;
+            std::copy(single.indices(0), single.indices(0) + single.count(0), out);
+            return single.count(0);
+        }
+        return engine_ == ENGINE_KDTREE || engine_ == ENGINE_DUAL_TREE ?
+            kdtree_->find_k_nearest_approx(query, k, weights, approx_, scratch, out) :
+            index()->find_k_nearest(query, k, weights, scratch, out);
+    }
+
+    // 按块并行处理查询；单线程时直接串行执行
+    void for_each_query(size_t n, size_t chunk, const ThreadPool::RangeFunction& body) {
+        if (num_threads_ <= 1) {
+            body(0, n);
+            return;
+        }
+        if (!pool_) pool_ = new ThreadPool(num_threads_);
+        pool_->parallel_for(n, chunk, body);
+    }
 
+    std::vector<int> predict_static(const Dataset* test_data, int k) {
+        std::vector<int> predictions;
+        if (!predict_with_neighbors(test_data, k, predictions, neighbor_buffer_)) {
+            predictions.clear();
+        }
         return predictions;
     }
 
     std::vector<int> predict_adaptive(const Dataset* test_data, int k) {
         std::vector<int> predictions;
         predictions.reserve(test_data->n_samples);
+        std::vector<size_t> neighbors;
 
         for (int i = 0; i < test_data->n_samples; i++) {
             const auto& current_weights = adaptive_weights_->get_weights();
+            if (i % PRESCALE_INTERVAL == 0) refresh_prescale(current_weights.data());
             
-            auto neighbors = kdtree_->find_k_nearest(
-                test_data->data[i].features, k, current_weights.data());
+            neighbors.resize(k > 0 ? k : 0);
+            KNN_STATS(auto start = SearchStats::now();)
+            int count = search_one(DatasetStorage::row(test_data, i), k, current_weights.data(),
+                                   neighbors.data());
+            KNN_STATS(SearchStats::record_query_latency(start);)
+            if (count < 0) return std::vector<int>();
+            neighbors.resize(count);
             
-            int prediction = make_prediction(neighbors);
+            int prediction = make_prediction(neighbors.data(), (int)neighbors.size());
             predictions.push_back(prediction);
 
             if (test_data->data[i].survived != -1) {
                 bool correct = (prediction == test_data->data[i].survived);
-                adaptive_weights_->update(test_data->data[i].features, 
+                adaptive_weights_->update(DatasetStorage::row(test_data, i), 
                                        neighbors, train_data_, correct);
             }
         }
@@ -110,12 +375,60 @@ private:
         return predictions;
     }
 
-    int make_prediction(const std::vector<size_t>& neighbors) {
+    // 小批量自适应：批内查询按块并行，共用批开始时发布的权重快照；
+    // 各线程把反馈累加在自己的计数里，块结束时并入批次总数（整数计数，合并顺序不影响结果）。
+    // 整批结束后一次更新权重并发布新快照
+    std::vector<int> predict_adaptive_batched(const Dataset* test_data, int k) {
+        size_t n = test_data->n_samples;
+        int n_features = train_data_->n_features;
+        std::vector<int> predictions(n, 0);
+        FeedbackAccumulator batch_feedback(n_features);
+        std::mutex feedback_mutex;
+        std::atomic<bool> ok(true);
+        adaptive_weights_->publish();
+
+        for (size_t first = 0; first < n; first += adaptive_batch_) {
+            size_t batch = std::min(adaptive_batch_, n - first);
+            std::shared_ptr<const WeightSnapshot> snapshot = adaptive_weights_->snapshot();
+            const double* weights = snapshot->weights.data();
+            refresh_prescale(weights);
+            neighbor_buffer_.resize(batch, k);
+
+            for_each_query(batch, QUERY_CHUNK, [&](size_t begin, size_t end) {
+                FeedbackAccumulator& feedback = thread_scratch().feedback;
+                feedback.reset(n_features);
+                for (size_t j = begin; j < end; j++) {
+                    size_t i = first + j;
+                    const double* query = DatasetStorage::row(test_data, i);
+                    size_t* neighbors = neighbor_buffer_.indices(j);
+                    KNN_STATS(auto start = SearchStats::now();)
+                    int count = search_one(query, k, weights, neighbors);
+                    KNN_STATS(SearchStats::record_query_latency(start);)
+                    if (count < 0) {
+                        ok = false;
+                        break;
+                    }
+                    predictions[i] = make_prediction(neighbors, count);
+                    if (test_data->data[i].survived != -1) {
+                        feedback.add(query, neighbors, count, train_data_,
+                                     predictions[i] == test_data->data[i].survived);
+                    }
+                }
+                std::lock_guard<std::mutex> lock(feedback_mutex);
+                batch_feedback.merge(feedback);
+            });
+            if (!ok) return std::vector<int>();
+            adaptive_weights_->apply(batch_feedback);
+        }
+        return predictions;
+    }
+
+    int make_prediction(const size_t* neighbors, int count) const {
         int survived_votes = 0;
-        for (size_t idx : neighbors) {
-            survived_votes += train_data_->data[idx].survived;
+        for (int i = 0; i < count; i++) {
+            survived_votes += train_data_->data[neighbors[i]].survived;
         }
-        return 2 * survived_votes >= neighbors.size();
+        return 2 * survived_votes >= count;
     }
 };
 
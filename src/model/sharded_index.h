@@ -0,0 +1,571 @@
+#ifndef SHARDED_INDEX_H
+#define SHARDED_INDEX_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include "kdtree.h"
+#include "../utils/numa.h"
+#include "../utils/local_socket.h"
+#include "../utils/thread_pool.h"
+
+// 一个分片的一次批量查询；指针在 collect() 返回前必须保持有效
+struct ShardRequest {
+    const double* queries;      // 行主序 n_queries × n_features
+    size_t n_queries;
+    int k;
+    const double* weights;      // 可为空
+    NeighborMatrix* out;        // 需已 resize(n_queries, k)；写入全局下标
+};
+
+// 分片：覆盖全局下标 [offset, offset + size) 的训练点。
+// submit 发出查询后立即返回，collect 等待结果，调用方先向所有分片 submit 再逐个 collect，
+// 各分片同时工作。
+class Shard {
+public:
+    virtual ~Shard() {}
+    virtual size_t offset() const = 0;
+    virtual size_t size() const = 0;
+    virtual int n_features() const = 0;
+    virtual size_t memory_bytes() const = 0;
+    virtual uint64_t digest() const = 0;   // 分片坐标的摘要，见 ShardProtocol::digest
+    virtual bool submit(const ShardRequest& request) = 0;
+    virtual bool collect() = 0;
+};
+
+// 分片服务的传输格式（本机进程间，字节序与结构布局相同）：
+//   连接后服务端先发 ShardHello，客户端用其中的摘要确认分片与自己的训练集一致；
+//   请求：ShardWireRequest，weights（has_weights 时 n_features 个 double），查询矩阵；
+//   响应：n_queries 个 int32 的近邻数，n_queries × k 个 uint64 全局下标，n_queries × k 个 double 距离。
+//   k 为 SHUTDOWN_K 的请求让服务端退出。
+struct ShardHello {
+    char magic[4];
+    uint32_t version;
+    int32_t n_features;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t digest;
+};
+
+struct ShardWireRequest {
+    uint64_t n_queries;
+    int32_t k;
+    int32_t has_weights;
+};
+
+class ShardProtocol {
+public:
+    static constexpr char MAGIC[4] = {'K', 'N', 'N', 'S'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr int32_t SHUTDOWN_K = -1;
+    static constexpr uint64_t MAX_QUERIES = 1 << 24;    // 单个请求的上限，防止异常请求耗尽内存
+    static constexpr int32_t MAX_K = 1 << 16;
+
+    // 第 [begin, end) 行坐标的 FNV-1a 摘要（含行数和维度），逐行全部参与
+    static uint64_t digest(const Dataset* dataset, size_t begin, size_t end) {
+        uint64_t hash = 14695981039346656037ULL;
+        uint64_t header[2] = {end - begin, (uint64_t)dataset->n_features};
+        hash = fnv1a(hash, reinterpret_cast<const char*>(header), sizeof(header));
+        if (end > begin) {
+            hash = fnv1a(hash, reinterpret_cast<const char*>(DatasetStorage::row(dataset, begin)),
+                         (end - begin) * dataset->n_features * sizeof(double));
+        }
+        return hash;
+    }
+
+    static bool send_results(LocalSocket& socket, const NeighborMatrix& results) {
+        size_t n = results.rows();
+        int k = results.k();
+        std::vector<int32_t> counts(n);
+        std::vector<uint64_t> indices(n * k, 0);
+        std::vector<double> distances(n * k, 0.0);
+        for (size_t q = 0; q < n; q++) {
+            counts[q] = results.count(q);
+            for (int j = 0; j < counts[q]; j++) {
+                indices[q * k + j] = results.indices(q)[j];
+                distances[q * k + j] = results.distances(q)[j];
+            }
+        }
+        return socket.send_all(counts.data(), n * sizeof(int32_t)) &&
+               socket.send_all(indices.data(), n * k * sizeof(uint64_t)) &&
+               socket.send_all(distances.data(), n * k * sizeof(double));
+    }
+
+    static bool recv_results(LocalSocket& socket, NeighborMatrix& results) {
+        size_t n = results.rows();
+        int k = results.k();
+        std::vector<int32_t> counts(n);
+        std::vector<uint64_t> indices(n * k);
+        if (!socket.recv_all(counts.data(), n * sizeof(int32_t)) ||
+            !socket.recv_all(indices.data(), n * k * sizeof(uint64_t))) {
+            return false;
+        }
+        for (size_t q = 0; q < n; q++) {
+            if (counts[q] < 0 || counts[q] > k) return false;
+            results.set_count(q, counts[q]);
+            for (int j = 0; j < k; j++) results.indices(q)[j] = (size_t)indices[q * k + j];
+        }
+        // 距离矩阵与传输格式的布局相同，直接收进去
+        return n * k == 0 || socket.recv_all(results.distances(0), n * k * sizeof(double));
+    }
+
+private:
+    static uint64_t fnv1a(uint64_t hash, const char* data, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+// 进程内分片：拷贝一段连续的行，建自己的 KD 树。
+// 所有工作在一个专属线程上进行，该线程先绑定到给定 CPU（通常是一个 NUMA 节点），
+// 再分配和初始化分片数据、建树，并创建分片内的查询线程池（继承同样的绑定），
+// 因此分片的内存和访问它的线程都在同一节点上。
+class LocalShard : public Shard {
+public:
+    LocalShard(const Dataset* dataset, size_t begin, size_t end,
+               const std::vector<int>& cpus = std::vector<int>(), int threads = 1)
+        : offset_(begin), size_(end > begin ? end - begin : 0),
+          n_features_(dataset ? dataset->n_features : 0), digest_(0), tree_(nullptr), pool_(nullptr),
+          has_job_(false), stop_(false) {
+        worker_ = std::thread([this, cpus] {
+            if (!cpus.empty()) NumaTopology::pin_current_thread(cpus);
+            worker_loop();
+        });
+        run([&] {
+            DatasetStorage::allocate(&data_, (int)size_, n_features_);
+            for (size_t i = 0; i < size_; i++) {
+                const double* row = DatasetStorage::row(dataset, begin + i);
+                std::copy(row, row + n_features_, data_.matrix + i * n_features_);
+                data_.data[i].survived = dataset->data[begin + i].survived;
+            }
+            digest_ = ShardProtocol::digest(&data_, 0, size_);
+            tree_ = new KDTree(&data_, KDTree::DEFAULT_LEAF_SIZE, 0, threads);
+            if (threads > 1) pool_ = new ThreadPool(threads);
+        });
+        collect();
+    }
+
+    ~LocalShard() {
+        run([this] {
+            delete pool_;
+            delete tree_;
+            DatasetStorage::release(&data_);
+        });
+        collect();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    LocalShard(const LocalShard&) = delete;
+    LocalShard& operator=(const LocalShard&) = delete;
+
+    size_t offset() const override { return offset_; }
+    size_t size() const override { return size_; }
+    int n_features() const override { return n_features_; }
+    size_t memory_bytes() const override {
+        return size_ * n_features_ * sizeof(double) + tree_->stats().memory_bytes;
+    }
+    uint64_t digest() const override { return digest_; }
+
+    bool submit(const ShardRequest& request) override {
+        run([this, request] { search(request); });
+        return true;
+    }
+
+    bool collect() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return !has_job_; });
+        return true;
+    }
+
+private:
+    static constexpr size_t QUERY_CHUNK = 64;
+
+    size_t offset_;
+    size_t size_;
+    int n_features_;
+    uint64_t digest_;
+    Dataset data_;
+    KDTree* tree_;
+    ThreadPool* pool_;
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    std::function<void()> job_;
+    bool has_job_;
+    bool stop_;
+
+    // 交给工作线程执行；一次只有一个任务，之前的任务需已 collect
+    void run(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = std::move(job);
+            has_job_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    void worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return has_job_ || stop_; });
+            if (!has_job_) return;
+            lock.unlock();
+            job_();
+            lock.lock();
+            has_job_ = false;
+            done_cv_.notify_all();
+        }
+    }
+
+    void search(const ShardRequest& request) {
+        auto body = [&](size_t begin, size_t end) {
+            static thread_local NeighborSet scratch;
+            for (size_t q = begin; q < end; q++) {
+                size_t* indices = request.out->indices(q);
+                int count = tree_->find_k_nearest(request.queries + q * n_features_, request.k,
+                                                  request.weights, scratch, indices,
+                                                  request.out->distances(q));
+                for (int j = 0; j < count; j++) indices[j] += offset_;
+                request.out->set_count(q, count);
+            }
+        };
+        if (pool_) {
+            pool_->parallel_for(request.n_queries, QUERY_CHUNK, body);
+        } else {
+            body(0, request.n_queries);
+        }
+    }
+};
+
+// 另一个进程中的分片，经本机套接字访问
+class RemoteShard : public Shard {
+public:
+    RemoteShard() : pending_(nullptr) {
+        memset(&hello_, 0, sizeof(hello_));
+    }
+
+    // 连接并读取分片信息
+    bool connect(const char* socket_path) {
+        if (!socket_.connect(socket_path) || !socket_.recv_all(&hello_, sizeof(hello_)) ||
+            memcmp(hello_.magic, ShardProtocol::MAGIC, sizeof(hello_.magic)) != 0 ||
+            hello_.version != ShardProtocol::VERSION) {
+            printf("无法连接分片服务: %s\n", socket_path);
+            socket_.close();
+            return false;
+        }
+        return true;
+    }
+
+    // 让服务端进程退出
+    bool shutdown_server() {
+        ShardWireRequest request = {0, ShardProtocol::SHUTDOWN_K, 0};
+        return socket_.send_all(&request, sizeof(request));
+    }
+
+    size_t offset() const override { return hello_.offset; }
+    size_t size() const override { return hello_.size; }
+    int n_features() const override { return hello_.n_features; }
+    size_t memory_bytes() const override { return 0; }
+    uint64_t digest() const override { return hello_.digest; }
+
+    bool submit(const ShardRequest& request) override {
+        pending_ = request.out;
+        ShardWireRequest header = {request.n_queries, request.k, request.weights != nullptr};
+        size_t d = hello_.n_features;
+        return socket_.send_all(&header, sizeof(header)) &&
+               (!request.weights || socket_.send_all(request.weights, d * sizeof(double))) &&
+               socket_.send_all(request.queries, request.n_queries * d * sizeof(double));
+    }
+
+    bool collect() override {
+        NeighborMatrix* out = pending_;
+        pending_ = nullptr;
+        return out && ShardProtocol::recv_results(socket_, *out);
+    }
+
+private:
+    LocalSocket socket_;
+    ShardHello hello_;
+    NeighborMatrix* pending_;
+};
+
+// 在本进程中提供一个分片的查询服务
+class ShardServer {
+public:
+    // 在 socket_path 上监听，逐个处理连接上的请求，直到收到关闭请求
+    static bool serve(const char* socket_path, LocalShard& shard) {
+        LocalSocket listener;
+        if (!listener.listen(socket_path)) {
+            printf("无法监听套接字: %s\n", socket_path);
+            return false;
+        }
+        ShardHello hello;
+        memset(&hello, 0, sizeof(hello));
+        memcpy(hello.magic, ShardProtocol::MAGIC, sizeof(hello.magic));
+        hello.version = ShardProtocol::VERSION;
+        hello.n_features = shard.n_features();
+        hello.offset = shard.offset();
+        hello.size = shard.size();
+        hello.digest = shard.digest();
+
+        LocalSocket client;
+        while (listener.accept(client)) {
+            if (!client.send_all(&hello, sizeof(hello))) continue;
+            if (!serve_connection(client, shard)) break;
+        }
+        unlink_socket(socket_path);
+        return true;
+    }
+
+private:
+    // 处理一个连接；收到关闭请求时返回 false
+    static bool serve_connection(LocalSocket& client, LocalShard& shard) {
+        size_t d = shard.n_features();
+        std::vector<double> weights(d);
+        std::vector<double> queries;
+        NeighborMatrix results;
+        ShardWireRequest header;
+        while (client.recv_all(&header, sizeof(header))) {
+            if (header.k == ShardProtocol::SHUTDOWN_K) return false;
+            if (header.k <= 0 || header.k > ShardProtocol::MAX_K ||
+                header.n_queries > ShardProtocol::MAX_QUERIES) {
+                printf("无效的分片请求\n");
+                break;
+            }
+            queries.resize(header.n_queries * d);
+            if ((header.has_weights && !client.recv_all(weights.data(), d * sizeof(double))) ||
+                !client.recv_all(queries.data(), queries.size() * sizeof(double))) {
+                break;
+            }
+            results.resize(header.n_queries, header.k);
+            ShardRequest request = {queries.data(), (size_t)header.n_queries, header.k,
+                                    header.has_weights ? weights.data() : nullptr, &results};
+            shard.submit(request);
+            shard.collect();
+            if (!ShardProtocol::send_results(client, results)) break;
+        }
+        client.close();
+        return true;
+    }
+
+    static void unlink_socket(const char* path) {
+#ifndef _WIN32
+        unlink(path);
+#else
+        (void)path;
+#endif
+    }
+};
+
+// 分片索引：训练集按行切成首尾相接的若干段，每段一个分片（进程内或其他进程中），
+// 查询发给所有分片，再把各分片按 (距离, 下标) 有序的 top-k 归并成全局 k 近邻。
+// 各分片的距离用同一内核计算，结果与整个训练集上的一棵 KD 树完全相同。
+// 同一时刻只处理一批查询（并发调用依次执行），并行发生在各分片和分片内的线程组里。
+class ShardedIndex : public SpatialIndex {
+public:
+    // 进程内分片：n_shards <= 0 时每个 NUMA 节点一个分片。
+    // 分片依次分到各节点上，同一节点上的分片平分该节点的 CPU 作为查询线程组
+    explicit ShardedIndex(const Dataset* dataset, int n_shards = 0)
+        : n_features_(dataset ? dataset->n_features : 0) {
+        if (!dataset || dataset->n_samples == 0) return;
+        std::vector<std::vector<int>> nodes = NumaTopology::nodes();
+        if (n_shards <= 0) n_shards = (int)nodes.size();
+        n_shards = std::min(n_shards, dataset->n_samples);
+        size_t n = dataset->n_samples;
+        for (int s = 0; s < n_shards; s++) {
+            const std::vector<int>& cpus = nodes[s % nodes.size()];
+            int on_node = (n_shards - 1 - s % (int)nodes.size()) / (int)nodes.size() + 1;
+            int threads = std::max(1, (int)cpus.size() / on_node);
+            shards_.push_back(new LocalShard(dataset, n * s / n_shards, n * (s + 1) / n_shards,
+                                             cpus, threads));
+        }
+        results_.resize(shards_.size());
+    }
+
+    // 使用给定的分片（取得所有权）；分片须按下标顺序首尾相接，维度相同
+    explicit ShardedIndex(const std::vector<Shard*>& shards)
+        : n_features_(shards.empty() ? 0 : shards[0]->n_features()), shards_(shards) {
+        size_t next = 0;
+        for (Shard* shard : shards_) {
+            if (shard->offset() != next || shard->n_features() != n_features_) {
+                printf("分片不连续或维度不一致\n");
+                for (Shard* s : shards_) delete s;
+                shards_.clear();
+                break;
+            }
+            next += shard->size();
+        }
+        results_.resize(shards_.size());
+    }
+
+    // 连接本机其他进程中的分片服务；任何一个连接失败时返回 NULL。
+    // 给定 expected 时，分片须恰好覆盖它的全部行，且每个分片的坐标摘要与其中对应的行一致
+    static ShardedIndex* connect(const std::vector<std::string>& socket_paths,
+                                 const Dataset* expected = nullptr) {
+        std::vector<Shard*> shards;
+        for (const std::string& path : socket_paths) {
+            RemoteShard* shard = new RemoteShard();
+            if (!shard->connect(path.c_str())) {
+                delete shard;
+                for (Shard* s : shards) delete s;
+                return nullptr;
+            }
+            shards.push_back(shard);
+        }
+        ShardedIndex* index = new ShardedIndex(shards);
+        if (!index->valid() || (expected && !index->matches(expected))) {
+            delete index;
+            return nullptr;
+        }
+        return index;
+    }
+
+    ~ShardedIndex() {
+        for (Shard* shard : shards_) delete shard;
+    }
+
+    ShardedIndex(const ShardedIndex&) = delete;
+    ShardedIndex& operator=(const ShardedIndex&) = delete;
+
+    bool valid() const { return !shards_.empty(); }
+    size_t n_shards() const { return shards_.size(); }
+    Shard* shard(size_t i) const { return shards_[i]; }
+
+    const char* name() const override { return "sharded"; }
+    int n_features() const override { return n_features_; }
+
+    size_t size() const override {
+        return shards_.empty() ? 0 : shards_.back()->offset() + shards_.back()->size();
+    }
+
+    IndexStats stats() const override {
+        IndexStats stats;
+        stats.points = size();
+        stats.nodes = shards_.size();
+        stats.depth = 1;
+        stats.leaf_size = KDTree::DEFAULT_LEAF_SIZE;
+        stats.memory_bytes = 0;
+        for (Shard* shard : shards_) stats.memory_bytes += shard->memory_bytes();
+        return stats;
+    }
+
+    int find_k_nearest(const double* query, int k, const double* weights, NeighborSet& scratch,
+                       size_t* out_indices, double* out_distances = nullptr) const override {
+        (void)scratch;
+        static thread_local NeighborMatrix single;
+        single.resize(1, k);
+        find_k_nearest_batch(query, 1, k, weights, single, 0);
+        int count = single.count(0);
+        std::copy(single.indices(0), single.indices(0) + count, out_indices);
+        if (out_distances) {
+            std::copy(single.distances(0), single.distances(0) + count, out_distances);
+        }
+        return count;
+    }
+
+    // 接口版本：分片失败时各行结果为空，需要知道是否失败的调用方使用 search_batch
+    void find_k_nearest_batch(const double* queries, size_t n_queries, int k,
+                              const double* weights, NeighborMatrix& out,
+                              size_t first_row) const override {
+        search_batch(queries, n_queries, k, weights, out, first_row);
+    }
+
+    // 批量查询；任何一个分片提交或收取失败时返回 false，此时各行结果为空
+    bool search_batch(const double* queries, size_t n_queries, int k,
+                      const double* weights, NeighborMatrix& out, size_t first_row) const {
+        for (size_t q = 0; q < n_queries; q++) out.set_count(first_row + q, 0);
+        if (n_queries == 0 || k <= 0) return true;
+        if (shards_.empty()) return false;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ShardRequest request = {queries, n_queries, k, weights, nullptr};
+        bool ok = true;
+        for (size_t s = 0; s < shards_.size(); s++) {
+            results_[s].resize(n_queries, k);
+            request.out = &results_[s];
+            ok = shards_[s]->submit(request) && ok;
+        }
+        for (size_t s = 0; s < shards_.size(); s++) {
+            ok = shards_[s]->collect() && ok;
+        }
+        if (!ok) {
+            printf("分片查询失败\n");
+            return false;
+        }
+        for (size_t q = 0; q < n_queries; q++) {
+            merge(q, k, out, first_row + q);
+        }
+        return true;
+    }
+
+private:
+    int n_features_;
+    std::vector<Shard*> shards_;
+    mutable std::vector<NeighborMatrix> results_;   // 每个分片一份，批次之间复用
+    mutable std::mutex mutex_;
+
+    bool matches(const Dataset* dataset) const {
+        if (size() != (size_t)dataset->n_samples || n_features_ != dataset->n_features) {
+            printf("分片的规模或维度与训练集不一致\n");
+            return false;
+        }
+        for (size_t s = 0; s < shards_.size(); s++) {
+            Shard* shard = shards_[s];
+            if (shard->digest() != ShardProtocol::digest(dataset, shard->offset(),
+                                                         shard->offset() + shard->size())) {
+                printf("分片 %zu 的数据与训练集不一致\n", s);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 把各分片第 q 行的有序结果归并为前 k 个，写入 out 的第 row 行
+    void merge(size_t q, int k, NeighborMatrix& out, size_t row) const {
+        size_t n_shards = shards_.size();
+        size_t heads[64];
+        std::vector<size_t> heap_heads;
+        size_t* head = n_shards <= 64 ? heads : (heap_heads.resize(n_shards), heap_heads.data());
+        std::fill(head, head + n_shards, 0);
+
+        size_t* indices = out.indices(row);
+        double* distances = out.distances(row);
+        int count = 0;
+        while (count < k) {
+            size_t best = n_shards;
+            NearestNeighbor best_item = {0.0, 0};
+            for (size_t s = 0; s < n_shards; s++) {
+                if (head[s] >= (size_t)results_[s].count(q)) continue;
+                NearestNeighbor item = {results_[s].distances(q)[head[s]],
+                                        results_[s].indices(q)[head[s]]};
+                if (best == n_shards || neighbor_precedes(item.distance, item.index, best_item)) {
+                    best = s;
+                    best_item = item;
+                }
+            }
+            if (best == n_shards) break;
+            head[best]++;
+            indices[count] = best_item.index;
+            distances[count] = best_item.distance;
+            count++;
+        }
+        out.set_count(row, count);
+    }
+};
+
+#endif // SHARDED_INDEX_H
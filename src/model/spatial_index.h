@@ -0,0 +1,55 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <stddef.h>
+#include "neighbor_set.h"
+
+// 索引结构统计
+struct IndexStats {
+    size_t points;
+    size_t nodes;
+    int depth;              // 根到最深叶子的层数
+    int leaf_size;          // 叶子桶容量上限（暴力引擎为 0）
+    size_t memory_bytes;    // 索引自身占用（不含原始数据集）
+};
+
+// kNN 索引的公共接口。构造即建索引；查询的输出约定统一为：
+// 近邻下标按 (平方距离, 下标) 升序，返回写出的个数（训练点不足 k 个时小于 k）。
+// 所有实现都是只读的，可被多个线程同时查询。
+class SpatialIndex {
+public:
+    virtual ~SpatialIndex() {}
+
+    virtual const char* name() const = 0;
+    virtual size_t size() const = 0;
+    virtual int n_features() const = 0;
+    virtual IndexStats stats() const = 0;
+
+    // 单个查询；scratch 在同一线程的多次查询间复用
+    virtual int find_k_nearest(const double* query, int k, const double* weights,
+                               NeighborSet& scratch, size_t* out_indices,
+                               double* out_distances = nullptr) const = 0;
+
+    // 批量查询：queries 为行主序的 n_queries × n_features 矩阵，
+    // 第 i 个查询的结果写入 out 的第 first_row + i 行（out 需已 resize 到足够行数）。
+    // 默认逐条调用 find_k_nearest，能整批处理的实现可以覆盖。
+    virtual void find_k_nearest_batch(const double* queries, size_t n_queries, int k,
+                                      const double* weights, NeighborMatrix& out,
+                                      size_t first_row) const {
+        NeighborSet& scratch = batch_scratch();
+        int d = n_features();
+        for (size_t q = 0; q < n_queries; q++) {
+            size_t row = first_row + q;
+            out.set_count(row, find_k_nearest(queries + q * d, k, weights, scratch,
+                                              out.indices(row), out.distances(row)));
+        }
+    }
+
+protected:
+    static NeighborSet& batch_scratch() {
+        static thread_local NeighborSet scratch;
+        return scratch;
+    }
+};
+
+#endif // SPATIAL_INDEX_H
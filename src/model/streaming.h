@@ -0,0 +1,74 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <stdio.h>
+#include <algorithm>
+#include "predictor.h"
+#include "../data/csv_stream.h"
+#include "../data/process.h"
+
+// 流式推理：按固定行数分块读取查询 CSV，用训练集上拟合的统计量预处理，
+// 预测后立即追加到输出文件。峰值内存只取决于块大小，与输入文件大小无关。
+class StreamingPredictor {
+public:
+    static constexpr size_t DEFAULT_CHUNK_ROWS = 4096;
+
+    StreamingPredictor(Predictor* predictor, const PreprocessStats& train_stats, int k,
+                       size_t chunk_rows = DEFAULT_CHUNK_ROWS)
+        : predictor_(predictor), stats_(train_stats), k_(k),
+          chunk_rows_(std::max((size_t)1, chunk_rows)) {}
+
+    // 返回预测的行数，打开文件或预测失败时返回 -1。
+    // 输出格式与 predictions.csv 相同；输入缺少 PassengerId 列时写行号。
+    long long run(const char* input_csv, const char* output_csv) {
+        CsvStreamReader reader;
+        if (!reader.open(input_csv)) return -1;
+        FILE* out = fopen(output_csv, "w");
+        if (!out) {
+            printf("无法写入文件: %s\n", output_csv);
+            return -1;
+        }
+        fprintf(out, "PassengerId,Survived\n");
+
+        // 整个过程复用同一个块数据集和解析缓冲
+        Dataset chunk = {};
+        DatasetStorage::allocate(&chunk, (int)chunk_rows_, FEATURE_COUNT);
+        DataLoader::ParsedChunk parsed;
+        long long total = 0;
+
+        size_t rows;
+        while ((rows = reader.read_rows(chunk_rows_, parsed)) > 0) {
+            chunk.n_samples = (int)rows;
+            memcpy(chunk.matrix, parsed.features.data(), parsed.features.size() * sizeof(double));
+            for (size_t i = 0; i < rows; i++) {
+                chunk.data[i].survived = parsed.labels[i];
+            }
+            DataProcessor::apply_stats(&chunk, stats_);
+
+            std::vector<int> predictions = predictor_->predict(&chunk, k_);
+            if (predictions.size() != rows) {
+                printf("预测失败\n");
+                total = -1;
+                break;
+            }
+            for (size_t i = 0; i < rows; i++) {
+                long long id = parsed.ids[i] >= 0 ? parsed.ids[i] : total + (long long)i + 1;
+                fprintf(out, "%lld,%d\n", id, predictions[i]);
+            }
+            total += rows;
+        }
+
+        chunk.n_samples = (int)chunk_rows_;
+        DatasetStorage::release(&chunk);
+        fclose(out);
+        return total;
+    }
+
+private:
+    Predictor* predictor_;
+    PreprocessStats stats_;
+    int k_;
+    size_t chunk_rows_;
+};
+
+#endif // STREAMING_H
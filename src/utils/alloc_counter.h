@@ -0,0 +1,55 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdlib.h>
+#include <cstddef>
+#include <new>
+#include "arena.h"
+
+// 定义 KNN_COUNT_ALLOCATIONS 时替换全局 operator new/delete，把每次堆分配计入
+// AllocationCounters。替换函数不能声明为 inline，所以本头文件只能由程序中的
+// 一个翻译单元（main.cpp）包含。
+#ifdef KNN_COUNT_ALLOCATIONS
+
+static void* counted_malloc(size_t size, size_t alignment) {
+    AllocationCounters::record_heap(size);
+    if (size == 0) size = 1;
+    void* ptr = nullptr;
+#ifdef _WIN32
+    ptr = _aligned_malloc(size, alignment);
+#else
+    if (alignment <= alignof(std::max_align_t)) {
+        ptr = malloc(size);
+    } else if (posix_memalign(&ptr, alignment, size) != 0) {
+        ptr = nullptr;
+    }
+#endif
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+static void counted_free(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+void* operator new(size_t size) { return counted_malloc(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size) { return counted_malloc(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t al) { return counted_malloc(size, (size_t)al); }
+void* operator new[](size_t size, std::align_val_t al) { return counted_malloc(size, (size_t)al); }
+
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+
+#endif // KNN_COUNT_ALLOCATIONS
+
+#endif // ALLOC_COUNTER_H
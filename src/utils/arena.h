@@ -0,0 +1,224 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// 分配统计快照
+struct AllocationStats {
+    unsigned long long heap_allocations;    // 全局 operator new 次数（需开启统计，见 alloc_counter.h）
+    unsigned long long heap_bytes;
+    unsigned long long arena_blocks;        // 内存池向系统申请的大块次数
+    unsigned long long arena_bytes;
+    unsigned long long arena_allocations;   // 从内存池切出的分配次数
+};
+
+// 全进程共享的分配计数器。比较热路径前后的快照即可确认其中没有堆分配。
+class AllocationCounters {
+public:
+    static AllocationStats snapshot() {
+        AllocationStats stats;
+        stats.heap_allocations = heap_allocations_.load(std::memory_order_relaxed);
+        stats.heap_bytes = heap_bytes_.load(std::memory_order_relaxed);
+        stats.arena_blocks = arena_blocks_.load(std::memory_order_relaxed);
+        stats.arena_bytes = arena_bytes_.load(std::memory_order_relaxed);
+        stats.arena_allocations = arena_allocations_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // 是否在统计全局 operator new（未开启时 heap_* 始终为 0）
+    static bool heap_counting_enabled() {
+#ifdef KNN_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static void record_heap(size_t bytes) {
+        heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+        heap_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static void record_arena_block(size_t bytes) {
+        arena_blocks_.fetch_add(1, std::memory_order_relaxed);
+        arena_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static void record_arena_allocation() {
+        arena_allocations_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    static inline std::atomic<unsigned long long> heap_allocations_{0};
+    static inline std::atomic<unsigned long long> heap_bytes_{0};
+    static inline std::atomic<unsigned long long> arena_blocks_{0};
+    static inline std::atomic<unsigned long long> arena_bytes_{0};
+    static inline std::atomic<unsigned long long> arena_allocations_{0};
+};
+
+// 线性内存池：从大块内存中按顺序切出对齐的分配，不能单独释放，析构或 release() 时整体归还。
+// 只用于存放无需析构的类型（特征矩阵、样本数组、树节点等）。
+// 开启大页时，不小于 2MB 的块用匿名映射申请：先尝试显式大页，失败再请求透明大页。
+class Arena {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    static constexpr size_t ALIGNMENT = 64;
+
+    explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE, bool huge_pages = default_huge_pages())
+        : head_(nullptr), cursor_(nullptr), limit_(nullptr),
+          block_size_(std::max(block_size, (size_t)ALIGNMENT)), huge_pages_(huge_pages),
+          reserved_(0), used_(0) {}
+
+    ~Arena() {
+        release();
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 分配 bytes 字节（alignment 为 2 的幂，不超过 ALIGNMENT），内容未初始化
+    void* allocate(size_t bytes, size_t alignment = ALIGNMENT) {
+        char* p = align_up(cursor_, alignment);
+        if (!head_ || p + bytes > limit_) {
+            add_block(bytes + alignment);
+            p = align_up(cursor_, alignment);
+        }
+        cursor_ = p + bytes;
+        used_ += bytes;
+        AllocationCounters::record_arena_allocation();
+        return p;
+    }
+
+    // 确保当前块还能放下 bytes 字节，不够时立即申请新块；已知总量时可让所有分配落在一个块里
+    void reserve(size_t bytes) {
+        if (!head_ || cursor_ + bytes > limit_) add_block(bytes);
+    }
+
+    template <typename T>
+    T* allocate_array(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Arena never runs destructors");
+        return static_cast<T*>(allocate(count * sizeof(T), ALIGNMENT));
+    }
+
+    // 归还所有内存块
+    void release() {
+        while (head_) {
+            Block* next = head_->next;
+            free_block(head_);
+            head_ = next;
+        }
+        cursor_ = limit_ = nullptr;
+        reserved_ = used_ = 0;
+    }
+
+    size_t bytes_reserved() const { return reserved_; }
+    size_t bytes_used() const { return used_; }
+    bool huge_pages() const { return huge_pages_; }
+
+    // 之后新建的内存池是否默认使用大页
+    static void set_default_huge_pages(bool enabled) {
+        default_huge_pages_flag().store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool default_huge_pages() {
+        return default_huge_pages_flag().load(std::memory_order_relaxed);
+    }
+
+private:
+    // 块头放在每个块的起始处，块之间组成单链表
+    struct Block {
+        Block* next;
+        size_t size;
+        bool mapped;
+    };
+
+    static constexpr size_t HEADER_SIZE = (sizeof(Block) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    Block* head_;
+    char* cursor_;
+    char* limit_;
+    size_t block_size_;
+    bool huge_pages_;
+    size_t reserved_;
+    size_t used_;
+
+    static std::atomic<bool>& default_huge_pages_flag() {
+        static std::atomic<bool> flag(false);
+        return flag;
+    }
+
+    static char* align_up(char* p, size_t alignment) {
+        return reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+
+    void add_block(size_t min_bytes) {
+        size_t size = std::max(block_size_, HEADER_SIZE + min_bytes);
+        Block* block = nullptr;
+        if (huge_pages_ && size >= HUGE_PAGE_SIZE) {
+            size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            block = map_huge(size);
+        }
+        if (!block) {
+            size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            block = static_cast<Block*>(::operator new(size, std::align_val_t(ALIGNMENT)));
+            block->mapped = false;
+        }
+        block->size = size;
+        block->next = head_;
+        head_ = block;
+        cursor_ = reinterpret_cast<char*>(block) + HEADER_SIZE;
+        limit_ = reinterpret_cast<char*>(block) + size;
+        reserved_ += size;
+        AllocationCounters::record_arena_block(size);
+    }
+
+    // Windows 的大页需要 SeLockMemoryPrivilege，这里不尝试，退回普通分配
+    static Block* map_huge(size_t size) {
+#if defined(_WIN32)
+        (void)size;
+        return nullptr;
+#else
+        void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (ptr == MAP_FAILED) {
+            ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+            madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        }
+        Block* block = static_cast<Block*>(ptr);
+        block->mapped = true;
+        return block;
+#endif
+    }
+
+    static void free_block(Block* block) {
+#ifndef _WIN32
+        if (block->mapped) {
+            munmap(block, block->size);
+            return;
+        }
+#endif
+        ::operator delete(block, std::align_val_t(ALIGNMENT));
+    }
+};
+
+#endif // ARENA_H
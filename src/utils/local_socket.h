@@ -0,0 +1,141 @@
+#ifndef LOCAL_SOCKET_H
+#define LOCAL_SOCKET_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// 本机进程间的流式连接（Unix 域套接字）。收发都按完整长度循环读写，
+// 对端关闭或出错时返回 false。Windows 下不可用，所有操作返回失败。
+class LocalSocket {
+public:
+    LocalSocket() : fd_(-1) {}
+    ~LocalSocket() { close(); }
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    // 在 path 上监听；已有同名的旧套接字文件时先删除
+    bool listen(const char* path) {
+#ifndef _WIN32
+        close();
+        sockaddr_un addr;
+        if (!make_address(path, &addr)) return false;
+        fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ < 0) return false;
+        unlink(path);
+        if (bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd_, 16) != 0) {
+            close();
+            return false;
+        }
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+
+    // 接受一个连接，写入 client
+    bool accept(LocalSocket& client) {
+#ifndef _WIN32
+        client.close();
+        int fd;
+        do {
+            fd = ::accept(fd_, nullptr, nullptr);
+        } while (fd < 0 && errno == EINTR);
+        client.fd_ = fd;
+        return fd >= 0;
+#else
+        (void)client;
+        return false;
+#endif
+    }
+
+    bool connect(const char* path) {
+#ifndef _WIN32
+        close();
+        sockaddr_un addr;
+        if (!make_address(path, &addr)) return false;
+        fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ < 0) return false;
+        if (::connect(fd_, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            close();
+            return false;
+        }
+        return true;
+#else
+        (void)path;
+        return false;
+#endif
+    }
+
+    bool send_all(const void* data, size_t size) {
+#ifndef _WIN32
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = ::send(fd_, p, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= (size_t)n;
+        }
+        return true;
+#else
+        (void)data;
+        (void)size;
+        return false;
+#endif
+    }
+
+    bool recv_all(void* data, size_t size) {
+#ifndef _WIN32
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t n = ::recv(fd_, p, size, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= (size_t)n;
+        }
+        return true;
+#else
+        (void)data;
+        (void)size;
+        return false;
+#endif
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    void close() {
+#ifndef _WIN32
+        if (fd_ >= 0) ::close(fd_);
+#endif
+        fd_ = -1;
+    }
+
+private:
+    int fd_;
+
+#ifndef _WIN32
+    static bool make_address(const char* path, sockaddr_un* addr) {
+        memset(addr, 0, sizeof(*addr));
+        addr->sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr->sun_path)) {
+            printf("套接字路径过长: %s\n", path);
+            return false;
+        }
+        strcpy(addr->sun_path, path);
+        return true;
+    }
+#endif
+};
+
+#endif // LOCAL_SOCKET_H
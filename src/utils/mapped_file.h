@@ -0,0 +1,144 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 内存映射文件。默认只读；copy_on_write 模式下映射可写，修改只对本进程可见、
+// 不会写回文件。空文件可以打开，此时 data() 为 NULL、size() 为 0。
+class MappedFile {
+public:
+    MappedFile() : data_(NULL), size_(0), is_open_(false) {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = NULL;
+#endif
+    }
+
+    explicit MappedFile(const char* path, bool copy_on_write = false) : MappedFile() {
+        open(path, copy_on_write);
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path, bool copy_on_write = false) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size)) {
+            close();
+            return false;
+        }
+        size_ = (size_t)size.QuadPart;
+        if (size_ > 0) {
+            mapping_ = CreateFileMappingA(file_, NULL,
+                                          copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY,
+                                          0, 0, NULL);
+            if (!mapping_) {
+                close();
+                return false;
+            }
+            data_ = static_cast<char*>(MapViewOfFile(
+                mapping_, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+            if (!data_) {
+                close();
+                return false;
+            }
+        }
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size_ = (size_t)st.st_size;
+        if (size_ > 0) {
+            void* ptr = copy_on_write ?
+                mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+                mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                return false;
+            }
+            data_ = static_cast<char*>(ptr);
+            if (!copy_on_write) madvise(ptr, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);        // 映射建立后即可关闭描述符
+#endif
+        is_open_ = true;
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = NULL;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) munmap(data_, size_);
+#endif
+        data_ = NULL;
+        size_ = 0;
+        is_open_ = false;
+    }
+
+    bool is_open() const { return is_open_; }
+    const char* data() const { return data_; }
+    char* mutable_data() { return data_; }     // 仅 copy_on_write 模式下可写
+    size_t size() const { return size_; }
+
+    // 文件大小和修改时间（纳秒，平台不支持时精确到秒），用于判断文件是否变化
+    static bool signature(const char* path, unsigned long long* size, long long* mtime_ns) {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA attr;
+        if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr)) return false;
+        *size = ((unsigned long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+        unsigned long long ticks = ((unsigned long long)attr.ftLastWriteTime.dwHighDateTime << 32) |
+                                   attr.ftLastWriteTime.dwLowDateTime;
+        *mtime_ns = (long long)(ticks * 100);
+#else
+        struct stat st;
+        if (stat(path, &st) != 0) return false;
+        *size = (unsigned long long)st.st_size;
+#if defined(__linux__)
+        *mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+        *mtime_ns = (long long)st.st_mtime * 1000000000LL;
+#endif
+#endif
+        return true;
+    }
+
+private:
+    char* data_;
+    size_t size_;
+    bool is_open_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -2,27 +2,262 @@
 #define MATH_H
 
 #include <math.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KNN_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// 标量内核同样关闭乘加融合：-mfma 或 -march=native 时 GCC 默认把 a*b+c 融合为 FMA，
+// 舍入与 SIMD 内核不同，距离相等的点的先后次序会因此改变。
+// GCC 用函数属性 KNN_NO_FP_CONTRACT；clang 不认该属性（默认 -ffp-contract=on 同样会融合），
+// 改在函数体开头写 KNN_FP_CONTRACT_OFF。两者都要写上。
+#if defined(__clang__)
+#define KNN_NO_FP_CONTRACT
+#define KNN_FP_CONTRACT_OFF _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define KNN_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#define KNN_FP_CONTRACT_OFF
+#else
+#define KNN_NO_FP_CONTRACT
+#define KNN_FP_CONTRACT_OFF
+#endif
+
+// 可用的向量指令级别，运行时检测
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// 距离内核的度量：METRIC_AUTO 在运行时按 weights 是否为空决定，
+// 另外两种在编译期确定，内层循环里没有分支
+enum DistanceMetric {
+    METRIC_AUTO,
+    METRIC_EUCLIDEAN,
+    METRIC_WEIGHTED
+};
+
+// 一个查询点到一块候选点的平方距离。
+// 候选点按列主序存放：第 d 维坐标位于 columns[d * stride + j]，j ∈ [0, n)。
+// weights 为空时计算普通欧氏距离的平方。
+typedef void (*BlockDistanceKernel)(const double* query, const double* columns,
+                                    size_t stride, size_t n, int dim,
+                                    const double* weights, double* out);
 
 class MathUtils {
 public:
     static double euclidean_distance(const double* p1, const double* p2, int dim) {
+        return sqrt(squared_distance(p1, p2, dim));
+    }
+
+    static double weighted_euclidean_distance(const double* p1, const double* p2,
+                                           int dim, const double* weights) {
+        return sqrt(weighted_squared_distance(p1, p2, dim, weights));
+    }
+
+    // 平方距离：只比较大小时无需开方。与块内核一样关闭乘加融合，结果与之逐位相同
+    KNN_NO_FP_CONTRACT
+    static double squared_distance(const double* p1, const double* p2, int dim) {
+        KNN_FP_CONTRACT_OFF
         double sum = 0.0;
         for (int i = 0; i < dim; i++) {
             double diff = p1[i] - p2[i];
             sum += diff * diff;
         }
-        return sqrt(sum);
+        return sum;
     }
 
-    static double weighted_euclidean_distance(const double* p1, const double* p2, 
-                                           int dim, const double* weights) {
+    KNN_NO_FP_CONTRACT
+    static double weighted_squared_distance(const double* p1, const double* p2,
+                                            int dim, const double* weights) {
+        KNN_FP_CONTRACT_OFF
         double sum = 0.0;
         for (int i = 0; i < dim; i++) {
             double diff = p1[i] - p2[i];
             sum += weights[i] * diff * diff;
         }
-        return sqrt(sum);
+        return sum;
+    }
+
+    // 批量平方距离，按当前 SIMD 级别分派。
+    // 各实现的运算顺序与标量版本一致，并关闭乘加融合，结果逐位相同。
+    static void squared_distances_block(const double* query, const double* columns,
+                                        size_t stride, size_t n, int dim,
+                                        const double* weights, double* out) {
+        kernel_slot()(query, columns, stride, n, dim, weights, out);
+    }
+
+    // 按维度和度量特化的内核（DIM 为 0 表示维度由参数 dim 给出），对应当前 SIMD 级别。
+    // 维度固定时编译器可以完全展开维度循环；结果与通用内核逐位相同。
+    template <int DIM, int METRIC>
+    static BlockDistanceKernel block_kernel() {
+#ifdef KNN_X86_SIMD
+        switch (level_slot()) {
+            case SIMD_AVX512: return block_avx512<DIM, METRIC>;
+            case SIMD_AVX2: return block_avx2<DIM, METRIC>;
+            case SIMD_SSE2: return block_sse2<DIM, METRIC>;
+            default: break;
+        }
+#endif
+        return block_scalar<DIM, METRIC>;
+    }
+
+    static SimdLevel simd_level() {
+        return level_slot();
+    }
+
+    // 强制使用某一级别（用于测试和基准对比），超出 CPU 支持范围时降级
+    static void set_simd_level(SimdLevel level) {
+        if (level > detect_simd_level()) level = detect_simd_level();
+        level_slot() = level;
+        kernel_slot() = kernel_for(level);
+    }
+
+    static const char* simd_level_name(SimdLevel level) {
+        switch (level) {
+            case SIMD_SSE2: return "sse2";
+            case SIMD_AVX2: return "avx2";
+            case SIMD_AVX512: return "avx512";
+            default: return "scalar";
+        }
+    }
+
+    static SimdLevel detect_simd_level() {
+#ifdef KNN_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+        if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+        if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+        return SIMD_SCALAR;
+    }
+
+private:
+    static SimdLevel& level_slot() {
+        static SimdLevel level = detect_simd_level();
+        return level;
+    }
+
+    static BlockDistanceKernel& kernel_slot() {
+        static BlockDistanceKernel kernel = kernel_for(level_slot());
+        return kernel;
+    }
+
+    static BlockDistanceKernel kernel_for(SimdLevel level) {
+#ifdef KNN_X86_SIMD
+        switch (level) {
+            case SIMD_AVX512: return block_avx512<0, METRIC_AUTO>;
+            case SIMD_AVX2: return block_avx2<0, METRIC_AUTO>;
+            case SIMD_SSE2: return block_sse2<0, METRIC_AUTO>;
+            default: break;
+        }
+#endif
+        (void)level;
+        return block_scalar<0, METRIC_AUTO>;
+    }
+
+    template <int DIM>
+    static int dims(int dim) {
+        return DIM > 0 ? DIM : dim;
+    }
+
+    template <int METRIC>
+    static bool use_weights(const double* weights) {
+        return METRIC == METRIC_AUTO ? weights != nullptr : METRIC == METRIC_WEIGHTED;
+    }
+
+    template <int DIM, int METRIC>
+    KNN_NO_FP_CONTRACT
+    static void block_scalar_range(const double* query, const double* columns,
+                                   size_t stride, size_t from, size_t n, int dim,
+                                   const double* weights, double* out) {
+        KNN_FP_CONTRACT_OFF
+        const bool weighted = use_weights<METRIC>(weights);
+        for (size_t j = from; j < n; j++) {
+            double sum = 0.0;
+            for (int d = 0; d < dims<DIM>(dim); d++) {
+                double diff = columns[d * stride + j] - query[d];
+                sum += weighted ? weights[d] * diff * diff : diff * diff;
+            }
+            out[j] = sum;
+        }
+    }
+
+    template <int DIM, int METRIC>
+    KNN_NO_FP_CONTRACT
+    static void block_scalar(const double* query, const double* columns,
+                             size_t stride, size_t n, int dim,
+                             const double* weights, double* out) {
+        block_scalar_range<DIM, METRIC>(query, columns, stride, 0, n, dim, weights, out);
+    }
+
+#ifdef KNN_X86_SIMD
+    template <int DIM, int METRIC>
+    __attribute__((target("sse2"))) KNN_NO_FP_CONTRACT
+    static void block_sse2(const double* query, const double* columns,
+                           size_t stride, size_t n, int dim,
+                           const double* weights, double* out) {
+        KNN_FP_CONTRACT_OFF
+        const bool weighted = use_weights<METRIC>(weights);
+        size_t j = 0;
+        for (; j + 2 <= n; j += 2) {
+            __m128d sum = _mm_setzero_pd();
+            for (int d = 0; d < dims<DIM>(dim); d++) {
+                __m128d diff = _mm_sub_pd(_mm_loadu_pd(columns + d * stride + j),
+                                          _mm_set1_pd(query[d]));
+                __m128d term = weighted ? _mm_mul_pd(_mm_set1_pd(weights[d]), diff) : diff;
+                sum = _mm_add_pd(sum, _mm_mul_pd(term, diff));
+            }
+            _mm_storeu_pd(out + j, sum);
+        }
+        block_scalar_range<DIM, METRIC>(query, columns, stride, j, n, dim, weights, out);
+    }
+
+    template <int DIM, int METRIC>
+    __attribute__((target("avx2"))) KNN_NO_FP_CONTRACT
+    static void block_avx2(const double* query, const double* columns,
+                           size_t stride, size_t n, int dim,
+                           const double* weights, double* out) {
+        KNN_FP_CONTRACT_OFF
+        const bool weighted = use_weights<METRIC>(weights);
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+            __m256d sum = _mm256_setzero_pd();
+            for (int d = 0; d < dims<DIM>(dim); d++) {
+                __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(columns + d * stride + j),
+                                             _mm256_set1_pd(query[d]));
+                __m256d term = weighted ? _mm256_mul_pd(_mm256_set1_pd(weights[d]), diff) : diff;
+                sum = _mm256_add_pd(sum, _mm256_mul_pd(term, diff));
+            }
+            _mm256_storeu_pd(out + j, sum);
+        }
+        block_scalar_range<DIM, METRIC>(query, columns, stride, j, n, dim, weights, out);
+    }
+
+    template <int DIM, int METRIC>
+    __attribute__((target("avx512f"))) KNN_NO_FP_CONTRACT
+    static void block_avx512(const double* query, const double* columns,
+                             size_t stride, size_t n, int dim,
+                             const double* weights, double* out) {
+        KNN_FP_CONTRACT_OFF
+        const bool weighted = use_weights<METRIC>(weights);
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8) {
+            __m512d sum = _mm512_setzero_pd();
+            for (int d = 0; d < dims<DIM>(dim); d++) {
+                __m512d diff = _mm512_sub_pd(_mm512_loadu_pd(columns + d * stride + j),
+                                             _mm512_set1_pd(query[d]));
+                __m512d term = weighted ? _mm512_mul_pd(_mm512_set1_pd(weights[d]), diff) : diff;
+                sum = _mm512_add_pd(sum, _mm512_mul_pd(term, diff));
+            }
+            _mm512_storeu_pd(out + j, sum);
+        }
+        block_scalar_range<DIM, METRIC>(query, columns, stride, j, n, dim, weights, out);
     }
+#endif
 };
 
 #endif // MATH_H 
\ No newline at end of file
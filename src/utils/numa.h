@@ -0,0 +1,99 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+// NUMA 拓扑与线程绑定。不依赖 libnuma：节点和 CPU 列表从 sysfs 读取，
+// 内存按 Linux 默认的首次访问策略落在访问它的线程所在的节点上，
+// 因此数据由绑定到某节点的线程分配并初始化，就会留在该节点。
+// 非 Linux 平台视为单个节点，绑定为空操作。
+class NumaTopology {
+public:
+    // 每个节点的 CPU 编号列表，至少有一个节点
+    static std::vector<std::vector<int>> nodes() {
+        std::vector<std::vector<int>> result;
+#ifdef __linux__
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (dir) {
+            std::vector<int> ids;
+            while (struct dirent* entry = readdir(dir)) {
+                int id;
+                char tail;
+                if (sscanf(entry->d_name, "node%d%c", &id, &tail) == 1) ids.push_back(id);
+            }
+            closedir(dir);
+            std::sort(ids.begin(), ids.end());
+            for (int id : ids) {
+                std::string path = "/sys/devices/system/node/node" + std::to_string(id) + "/cpulist";
+                std::vector<int> cpus = read_cpu_list(path.c_str());
+                if (!cpus.empty()) result.push_back(cpus);
+            }
+        }
+#endif
+        if (result.empty()) {
+            unsigned int n = std::thread::hardware_concurrency();
+            result.emplace_back();
+            for (unsigned int cpu = 0; cpu < (n > 0 ? n : 1); cpu++) {
+                result.back().push_back((int)cpu);
+            }
+        }
+        return result;
+    }
+
+    // 把当前线程绑定到给定 CPU 上；之后由它创建的线程继承同样的绑定
+    static bool pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+        if (cpus.empty()) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+
+private:
+    // 解析形如 "0-3,8-11" 的 CPU 列表
+    static std::vector<int> read_cpu_list(const char* path) {
+        std::vector<int> cpus;
+        FILE* file = fopen(path, "r");
+        if (!file) return cpus;
+        char buffer[4096];
+        if (fgets(buffer, sizeof(buffer), file)) {
+            char* p = buffer;
+            while (*p) {
+                char* end;
+                long first = strtol(p, &end, 10);
+                if (end == p) break;
+                long last = first;
+                p = end;
+                if (*p == '-') {
+                    last = strtol(p + 1, &end, 10);
+                    p = end;
+                }
+                for (long cpu = first; cpu <= last; cpu++) cpus.push_back((int)cpu);
+                if (*p == ',') p++;
+                else break;
+            }
+        }
+        fclose(file);
+        return cpus;
+    }
+};
+
+#endif // NUMA_H
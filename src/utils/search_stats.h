@@ -0,0 +1,231 @@
+#ifndef SEARCH_STATS_H
+#define SEARCH_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+// 搜索热路径的统计。定义 KNN_ENABLE_STATS 时 KNN_STATS(...) 展开为其中的语句，
+// 否则展开为空，计数和计时代码完全不参与编译。
+#ifdef KNN_ENABLE_STATS
+#define KNN_STATS(...) __VA_ARGS__
+#else
+#define KNN_STATS(...)
+#endif
+
+// 一次树搜索的计数，在搜索循环里用局部变量累加，结束时一次并入全局统计
+struct QueryCounters {
+    unsigned long long nodes_visited;           // 下降经过的内部节点和扫描的叶子
+    unsigned long long distance_evaluations;
+    unsigned long long subtrees_pruned;         // 出栈时因下界超过第 k 近距离而跳过的子树
+    unsigned long long max_stack_depth;
+};
+
+// 对数-线性分桶的直方图：小于 16 的值各占一桶，之后每个 2 的幂区间分 8 桶，
+// 相对误差不超过 12.5%。各桶是独立的原子计数，多个线程可以同时记录。
+class LogHistogram {
+public:
+    static constexpr int SUB_BUCKETS = 8;
+    static constexpr int LINEAR_LIMIT = 16;
+    static constexpr int BUCKETS = LINEAR_LIMIT + (64 - 4) * SUB_BUCKETS;
+
+    void record(uint64_t value) {
+        counts_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+        seen = min_.load(std::memory_order_relaxed);
+        while (value < seen && !min_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    void reset() {
+        for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+        total_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+        min_.store(UINT64_MAX, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t min() const { return count() ? min_.load(std::memory_order_relaxed) : 0; }
+    double mean() const { return count() ? (double)sum_.load(std::memory_order_relaxed) / count() : 0.0; }
+
+    // 第 q 分位（0 < q <= 1）所在桶的上界，不超过记录到的最大值
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(q * total + 0.5);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts_[b].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t upper = bucket_upper(b);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    // 写成 JSON 对象：概要分位数加非空桶的 [下界, 次数] 列表
+    void write_json(FILE* file) const {
+        fprintf(file, "{\"count\": %llu, \"min\": %llu, \"mean\": %.1f, \"p50\": %llu, "
+                      "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu, \"buckets\": [",
+                (unsigned long long)count(), (unsigned long long)min(), mean(),
+                (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.9),
+                (unsigned long long)percentile(0.99), (unsigned long long)percentile(0.999),
+                (unsigned long long)max());
+        bool first = true;
+        for (int b = 0; b < BUCKETS; b++) {
+            uint64_t n = counts_[b].load(std::memory_order_relaxed);
+            if (n == 0) continue;
+            fprintf(file, "%s[%llu, %llu]", first ? "" : ", ",
+                    (unsigned long long)bucket_lower(b), (unsigned long long)n);
+            first = false;
+        }
+        fprintf(file, "]}");
+    }
+
+private:
+    std::atomic<uint64_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+    std::atomic<uint64_t> min_{UINT64_MAX};
+
+    static int bucket_of(uint64_t value) {
+        if (value < LINEAR_LIMIT) return (int)value;
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = (int)(value >> (exponent - 3)) & (SUB_BUCKETS - 1);
+        return LINEAR_LIMIT + (exponent - 4) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t bucket_lower(int b) {
+        if (b < LINEAR_LIMIT) return (uint64_t)b;
+        int exponent = (b - LINEAR_LIMIT) / SUB_BUCKETS + 4;
+        int sub = (b - LINEAR_LIMIT) % SUB_BUCKETS;
+        return ((uint64_t)(SUB_BUCKETS + sub)) << (exponent - 3);
+    }
+
+    static uint64_t bucket_upper(int b) {
+        return b + 1 < BUCKETS ? bucket_lower(b + 1) - 1 : UINT64_MAX;
+    }
+};
+
+// 全进程共享的搜索统计
+class SearchStats {
+public:
+    static bool enabled() {
+#ifdef KNN_ENABLE_STATS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static void record_search(const QueryCounters& counters) {
+        searches_.fetch_add(1, std::memory_order_relaxed);
+        nodes_visited_.fetch_add(counters.nodes_visited, std::memory_order_relaxed);
+        distance_evaluations_.fetch_add(counters.distance_evaluations, std::memory_order_relaxed);
+        subtrees_pruned_.fetch_add(counters.subtrees_pruned, std::memory_order_relaxed);
+        unsigned long long seen = max_stack_depth_.load(std::memory_order_relaxed);
+        while (counters.max_stack_depth > seen &&
+               !max_stack_depth_.compare_exchange_weak(seen, counters.max_stack_depth,
+                                                       std::memory_order_relaxed)) {}
+        evaluations_per_search_.record(counters.distance_evaluations);
+    }
+
+    static std::chrono::steady_clock::time_point now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    // 单条查询从发起到拿到结果的耗时（纳秒），只记录逐条计时的查询
+    static void record_query_latency(std::chrono::steady_clock::time_point start) {
+        query_latency_.record(elapsed_ns(start));
+    }
+
+    // 批量引擎一次调用处理一块 n_queries 条查询的总耗时（纳秒），每块一个样本。
+    // 块内各条查询的耗时分不开，平摊后没有尾部，因此不计入 query_latency
+    static void record_chunk_latency(std::chrono::steady_clock::time_point start,
+                                     uint64_t n_queries) {
+        chunk_latency_.record(elapsed_ns(start));
+        chunk_queries_.fetch_add(n_queries, std::memory_order_relaxed);
+    }
+
+    // 一次批量预测的总耗时（纳秒）
+    static void record_batch_latency(std::chrono::steady_clock::time_point start) {
+        batch_latency_.record(elapsed_ns(start));
+    }
+
+    static unsigned long long searches() { return searches_.load(std::memory_order_relaxed); }
+    static unsigned long long nodes_visited() { return nodes_visited_.load(std::memory_order_relaxed); }
+    static unsigned long long distance_evaluations() {
+        return distance_evaluations_.load(std::memory_order_relaxed);
+    }
+    static unsigned long long subtrees_pruned() { return subtrees_pruned_.load(std::memory_order_relaxed); }
+    static unsigned long long max_stack_depth() { return max_stack_depth_.load(std::memory_order_relaxed); }
+    static const LogHistogram& evaluations_per_search() { return evaluations_per_search_; }
+    static const LogHistogram& query_latency() { return query_latency_; }
+    static const LogHistogram& chunk_latency() { return chunk_latency_; }
+    static unsigned long long chunk_queries() { return chunk_queries_.load(std::memory_order_relaxed); }
+    static const LogHistogram& batch_latency() { return batch_latency_; }
+
+    static void reset() {
+        searches_.store(0, std::memory_order_relaxed);
+        nodes_visited_.store(0, std::memory_order_relaxed);
+        distance_evaluations_.store(0, std::memory_order_relaxed);
+        subtrees_pruned_.store(0, std::memory_order_relaxed);
+        max_stack_depth_.store(0, std::memory_order_relaxed);
+        evaluations_per_search_.reset();
+        query_latency_.reset();
+        chunk_latency_.reset();
+        chunk_queries_.store(0, std::memory_order_relaxed);
+        batch_latency_.reset();
+    }
+
+    static bool dump_json(const char* path) {
+        FILE* file = fopen(path, "w");
+        if (!file) {
+            printf("无法创建文件: %s\n", path);
+            return false;
+        }
+        fprintf(file, "{\n  \"enabled\": %s,\n  \"searches\": %llu,\n  \"nodes_visited\": %llu,\n"
+                      "  \"distance_evaluations\": %llu,\n  \"subtrees_pruned\": %llu,\n"
+                      "  \"max_stack_depth\": %llu,\n",
+                enabled() ? "true" : "false", searches(), nodes_visited(), distance_evaluations(),
+                subtrees_pruned(), max_stack_depth());
+        fprintf(file, "  \"evaluations_per_search\": ");
+        evaluations_per_search_.write_json(file);
+        fprintf(file, ",\n  \"query_latency_ns\": ");
+        query_latency_.write_json(file);
+        fprintf(file, ",\n  \"chunk_queries\": %llu,\n  \"chunk_latency_ns\": ", chunk_queries());
+        chunk_latency_.write_json(file);
+        fprintf(file, ",\n  \"batch_latency_ns\": ");
+        batch_latency_.write_json(file);
+        fprintf(file, "\n}\n");
+        fclose(file);
+        return true;
+    }
+
+private:
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    static inline std::atomic<unsigned long long> searches_{0};
+    static inline std::atomic<unsigned long long> nodes_visited_{0};
+    static inline std::atomic<unsigned long long> distance_evaluations_{0};
+    static inline std::atomic<unsigned long long> subtrees_pruned_{0};
+    static inline std::atomic<unsigned long long> max_stack_depth_{0};
+    static inline LogHistogram evaluations_per_search_;
+    static inline LogHistogram query_latency_;
+    static inline LogHistogram chunk_latency_;
+    static inline std::atomic<unsigned long long> chunk_queries_{0};
+    static inline LogHistogram batch_latency_;
+};
+
+#endif // SEARCH_STATS_H
@@ -0,0 +1,166 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 工作窃取线程池：把区间切成块后分给各线程的双端队列，
+// 线程从自己队列的头部取块，空闲时从其他队列的尾部窃取。
+// 调用 parallel_for 的线程本身也参与执行。
+class ThreadPool {
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeFunction;
+
+    explicit ThreadPool(int num_threads = 0)
+        : body_(nullptr), generation_(0), active_(0), remaining_(0), stop_(false) {
+        if (num_threads <= 0) num_threads = default_threads();
+        for (int i = 0; i < num_threads; i++) {
+            queues_.emplace_back(new WorkQueue());
+        }
+        // 0 号队列属于调用线程，其余各对应一个工作线程
+        for (int i = 1; i < num_threads; i++) {
+            workers_.emplace_back(&ThreadPool::worker_loop, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(job_mutex_);
+            stop_ = true;
+        }
+        job_cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static int default_threads() {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n > 0 ? (int)n : 1;
+    }
+
+    int size() const { return (int)queues_.size(); }
+
+    // 对 [0, n) 按 chunk_size 分块并行执行 body(begin, end)，返回时全部完成。
+    // 每个下标只被处理一次，调用方按下标写结果即可得到与串行相同的输出。
+    void parallel_for(size_t n, size_t chunk_size, const RangeFunction& body) {
+        if (n == 0) return;
+        if (chunk_size == 0) chunk_size = 1;
+        if (size() == 1 || n <= chunk_size) {
+            body(0, n);
+            return;
+        }
+
+        std::lock_guard<std::mutex> run_lock(run_mutex_);
+        size_t n_chunks = (n + chunk_size - 1) / chunk_size;
+        for (size_t c = 0; c < n_chunks; c++) {
+            size_t begin = c * chunk_size;
+            size_t end = std::min(n, begin + chunk_size);
+            WorkQueue& queue = *queues_[c % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.chunks.push_back(std::make_pair(begin, end));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(job_mutex_);
+            body_ = &body;
+            remaining_.store(n_chunks);
+            generation_++;
+        }
+        job_cv_.notify_all();
+
+        run_chunks(0);
+
+        // 等待所有块完成且没有线程仍持有本次任务，之后才能复用队列
+        std::unique_lock<std::mutex> lock(job_mutex_);
+        done_cv_.wait(lock, [this] { return remaining_.load() == 0 && active_ == 0; });
+        body_ = nullptr;
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::pair<size_t, size_t>> chunks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex run_mutex_;              // 同一时刻只运行一个 parallel_for
+    std::mutex job_mutex_;
+    std::condition_variable job_cv_;
+    std::condition_variable done_cv_;
+    const RangeFunction* body_;
+    size_t generation_;
+    int active_;                        // 正在执行 run_chunks 的线程数
+    std::atomic<size_t> remaining_;
+    bool stop_;
+
+    bool pop_local(int id, std::pair<size_t, size_t>& chunk) {
+        WorkQueue& queue = *queues_[id];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.chunks.empty()) return false;
+        chunk = queue.chunks.front();
+        queue.chunks.pop_front();
+        return true;
+    }
+
+    bool steal(int id, std::pair<size_t, size_t>& chunk) {
+        int n = size();
+        for (int offset = 1; offset < n; offset++) {
+            WorkQueue& victim = *queues_[(id + offset) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.back();
+                victim.chunks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_chunks(int id) {
+        const RangeFunction* body;
+        {
+            std::lock_guard<std::mutex> lock(job_mutex_);
+            body = body_;
+            if (!body) return;
+            active_++;
+        }
+
+        std::pair<size_t, size_t> chunk;
+        while (pop_local(id, chunk) || steal(id, chunk)) {
+            (*body)(chunk.first, chunk.second);
+            remaining_.fetch_sub(1);
+        }
+
+        std::lock_guard<std::mutex> lock(job_mutex_);
+        active_--;
+        done_cv_.notify_all();
+    }
+
+    void worker_loop(int id) {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(job_mutex_);
+                job_cv_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+            }
+            run_chunks(id);
+        }
+    }
+};
+
+#endif // THREAD_POOL_H